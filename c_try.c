@@ -1,24 +1,82 @@
 /*
     Test program for my xdg_base_dir.[ch] library. Invoke as follows:
 
-    c_try op pathtype path
+    c_try [-u user | -H home] [-m manifest | -r sysroot] op pathtype path...
 
     where op indicates the operation to perform, viz:
-        read    -- find highest-priority existing file/dir path
-        write   -- create user-specific file path
-        findall -- find all existing file/dir paths
-    pathtype indicates what type of path we're dealing with (config, data or cache),
-    and path is the file/dir path string.
+        read     -- find highest-priority existing file/dir path
+        write    -- create user-specific file path
+        findall  -- find all existing file/dir paths
+        open     -- open highest-priority existing file, show its path and size
+        prefetch -- open highest-priority existing file for each of several paths
+        variant  -- find best of several alternative paths, directory priority first
+        variantc -- find best of several alternative paths, path order first
+        blobput  -- store standard input in the blob store for appname path,
+                    and show its digest
+        blobget  -- copy the blob with the digest given as the second path from
+                    the blob store for appname path to standard output
+        export   -- look up the paths up to a "--" argument, then run the command
+                    following it with the resolution results handed down to it
+    pathtype indicates what type of path we're dealing with (config, data, cache or runtime),
+    and path is the file/dir path string. read, write, findall, open and blobput take a
+    single path, and blobget two; the blob operations require cache, and open, prefetch,
+    variant, variantc and export require config or data. When variant or variantc is
+    given a single path, the result is checked against read.
+
+    The options resolve via a context instead of the calling process's environment:
+        -u user     -- for the named user
+        -H home     -- for the specified home directory, with the calling process's
+                       XDG_xxx settings
+        -m manifest -- against an in-memory tree loaded from the manifest file (as
+                       produced by "find . -printf '%y %s %P\n'")
+        -r sysroot  -- against the tree under the directory sysroot
 
     Written by Lawrence D'Oliveiro <ldo@geek-central.gen.nz>.
 */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include "xdg_base_dir.h"
 
+extern char ** environ;
+
+static int parse_digest
+  (
+    const char * hex,
+    unsigned char digest[XDG_BLOB_DIGEST_SIZE]
+  )
+  /* decodes a digest from hexadecimal, returning nonzero if it isn't valid. */
+  {
+    int status = 0;
+    int i;
+    unsigned int byte;
+    if (strlen(hex) != XDG_BLOB_DIGEST_SIZE * 2)
+      {
+        status = -1;
+      }
+    else
+      {
+        for (i = 0; i < XDG_BLOB_DIGEST_SIZE; ++i)
+          {
+            if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+              {
+                status = -1;
+                break;
+              } /*if*/
+            digest[i] = byte;
+          } /*for*/
+      } /*if*/
+    return
+        status;
+  } /*parse_digest*/
+
 int main
   (
     int argc,
@@ -26,50 +84,230 @@ int main
   )
   {
     int status = 0;
+    const char * username = 0;
+    const char * home = 0;
+    const char * manifest = 0;
+    const char * sysroot = 0;
+    xdg_fs_backend * backend = 0;
+    xdg_context * ctx = 0;
     const char * op;
     const char * pathtype;
     const char * itempath;
+    const char * const * itempaths;
+    int nr_items;
+    bool config;
     const char * result = 0;
+    int opt;
     do /*once*/
       {
-        if (argc != 4)
+        while ((opt = getopt(argc, argv, "+u:H:m:r:")) != -1)
           {
-            fprintf(stderr, "usage: %s read|write|findall config|data|cache path\n", argv[0]);
+            switch (opt)
+              {
+            case 'u':
+                username = optarg;
+            break;
+            case 'H':
+                home = optarg;
+            break;
+            case 'm':
+                manifest = optarg;
+            break;
+            case 'r':
+                sysroot = optarg;
+            break;
+            default:
+                status = 1;
+            break;
+              } /*switch*/
+          } /*while*/
+        if
+          (
+                status != 0
+            ||
+                argc - optind < 3
+            ||
+                (username != 0 && home != 0)
+            ||
+                (manifest != 0 && sysroot != 0)
+          )
+          {
+            fprintf
+              (
+                stderr,
+                "usage: %s [-u user | -H home] [-m manifest | -r sysroot]"
+                " read|write|findall|open|prefetch|variant|variantc|blobput|blobget|export"
+                " config|data|cache|runtime path...\n",
+                argv[0]
+              );
             status = 1;
             break;
           } /*if*/
-        op = argv[1];
-        pathtype = argv[2];
-        itempath = argv[3];
+        op = argv[optind];
+        pathtype = argv[optind + 1];
+        itempaths = (const char * const *)argv + optind + 2;
+        nr_items = argc - optind - 2;
+        itempath = itempaths[0];
+        config = strcmp(pathtype, "config") == 0;
         if
           (
-                strcmp(op, "read") != 0 && strcmp(op, "write") != 0 && strcmp(op, "findall") != 0
+                (
+                    strcmp(op, "read") != 0
+                &&
+                    strcmp(op, "write") != 0
+                &&
+                    strcmp(op, "findall") != 0
+                &&
+                    strcmp(op, "open") != 0
+                &&
+                    strcmp(op, "prefetch") != 0
+                &&
+                    strcmp(op, "variant") != 0
+                &&
+                    strcmp(op, "variantc") != 0
+                &&
+                    strcmp(op, "blobput") != 0
+                &&
+                    strcmp(op, "blobget") != 0
+                &&
+                    strcmp(op, "export") != 0
+                )
             ||
+                (
                     strcmp(pathtype, "config") != 0
                 &&
                     strcmp(pathtype, "data") != 0
                 &&
                     strcmp(pathtype, "cache") != 0
+                &&
+                    strcmp(pathtype, "runtime") != 0
+                )
           )
           {
             fprintf(stderr,
-                "op must be read, write or findall and pathtype must be config, data or cache\n");
+                "op must be read, write, findall, open, prefetch, variant, variantc, blobput,"
+                " blobget or export and pathtype must be config, data, cache or runtime\n");
+            status = 1;
+            break;
+          } /*if*/
+        if
+          (
+                (
+                    (
+                        strcmp(op, "read") == 0
+                    ||
+                        strcmp(op, "write") == 0
+                    ||
+                        strcmp(op, "findall") == 0
+                    ||
+                        strcmp(op, "open") == 0
+                    ||
+                        strcmp(op, "blobput") == 0
+                    )
+                &&
+                    nr_items != 1
+                )
+            ||
+                (strcmp(op, "blobget") == 0 && nr_items != 2)
+          )
+          {
+            fprintf(stderr, "wrong number of paths for %s\n", op);
+            status = 1;
+            break;
+          } /*if*/
+        if
+          (
+                (
+                    (strcmp(op, "blobput") == 0 || strcmp(op, "blobget") == 0)
+                &&
+                    strcmp(pathtype, "cache") != 0
+                )
+            ||
+                (
+                    (
+                        strcmp(op, "open") == 0
+                    ||
+                        strcmp(op, "prefetch") == 0
+                    ||
+                        strcmp(op, "variant") == 0
+                    ||
+                        strcmp(op, "variantc") == 0
+                    ||
+                        strcmp(op, "export") == 0
+                    )
+                &&
+                    strcmp(pathtype, "config") != 0
+                &&
+                    strcmp(pathtype, "data") != 0
+                )
+          )
+          {
+            fprintf(stderr, "%s not applicable to pathtype %s\n", op, pathtype);
             status = 1;
             break;
           } /*if*/
+        if (manifest != 0)
+          {
+            backend = xdg_memfs_backend_new();
+            if (backend == 0 || xdg_memfs_load_manifest(backend, manifest) != 0)
+              {
+                fprintf(stderr, "error %d loading manifest -- %s\n", errno, strerror(errno));
+                status = 2;
+                break;
+              } /*if*/
+          }
+        else if (sysroot != 0)
+          {
+            backend = xdg_sysroot_backend_new(sysroot);
+            if (backend == 0)
+              {
+                fprintf(stderr, "error %d setting up sysroot -- %s\n", errno, strerror(errno));
+                status = 2;
+                break;
+              } /*if*/
+          } /*if*/
+        if (username != 0)
+          {
+            ctx = xdg_context_new_for_user(username);
+          }
+        else if (home != 0 || backend != 0)
+          {
+            ctx = xdg_context_new
+              (
+                /*home =*/ home != 0 ? home : getenv("HOME"),
+                /*uid =*/ geteuid(),
+                /*vars =*/ (const char * const *)environ
+              );
+          } /*if*/
+        if ((username != 0 || home != 0 || backend != 0) && ctx == 0)
+          {
+            fprintf(stderr, "error %d creating context -- %s\n", errno, strerror(errno));
+            status = 2;
+            break;
+          } /*if*/
+        if (backend != 0 && xdg_context_set_backend(ctx, backend) != 0)
+          {
+            fprintf(stderr, "error %d setting backend -- %s\n", errno, strerror(errno));
+            status = 2;
+            break;
+          } /*if*/
         if (strcmp(op, "read") == 0)
           {
             if (strcmp(pathtype, "config") == 0)
               {
-                result = xdg_find_first_config_path(itempath);
+                result = xdg_context_find_first_config_path(ctx, itempath);
               }
             else if (strcmp(pathtype, "data") == 0)
               {
-                result = xdg_find_first_data_path(itempath);
+                result = xdg_context_find_first_data_path(ctx, itempath);
               }
             else if (strcmp(pathtype, "cache") == 0)
               {
-                result = xdg_find_cache_path(itempath, false);
+                result = xdg_context_find_cache_path(ctx, itempath, false);
+              }
+            else if (strcmp(pathtype, "runtime") == 0)
+              {
+                result = xdg_context_get_runtime_dir(ctx, false);
               } /*if*/
             if (result == 0)
               {
@@ -78,21 +316,30 @@ int main
                 break;
               } /*if*/
             fputs(result, stdout);
+            if (strcmp(pathtype, "runtime") == 0)
+              {
+                fputs("/", stdout);
+                fputs(itempath, stdout);
+              } /*if*/
             fputs("\n", stdout);
           }
         else if (strcmp(op, "write") == 0)
           {
             if (strcmp(pathtype, "config") == 0)
               {
-                result = xdg_get_config_home(true);
+                result = xdg_context_get_config_home(ctx, true);
               }
             else if (strcmp(pathtype, "data") == 0)
               {
-                result = xdg_get_data_home(true);
+                result = xdg_context_get_data_home(ctx, true);
               }
             else if (strcmp(pathtype, "cache") == 0)
               {
-                result = xdg_get_cache_home(true);
+                result = xdg_context_get_cache_home(ctx, true);
+              }
+            else if (strcmp(pathtype, "runtime") == 0)
+              {
+                result = xdg_context_get_runtime_dir(ctx, true);
               } /*if*/
             if (result == 0)
               {
@@ -145,8 +392,9 @@ int main
               } /*another_item*/;
             if (strcmp(pathtype, "config") == 0)
               {
-                status = xdg_find_all_config_path
+                status = xdg_context_find_all_config_path
                   (
+                    /*ctx =*/ ctx,
                     /*itempath =*/ itempath,
                     /*action =*/ another_item,
                     /*actionarg =*/ 0,
@@ -160,8 +408,9 @@ int main
               }
             else if (strcmp(pathtype, "data") == 0)
               {
-                status = xdg_find_all_data_path
+                status = xdg_context_find_all_data_path
                   (
+                    /*ctx =*/ ctx,
                     /*itempath =*/ itempath,
                     /*action =*/ another_item,
                     /*actionarg =*/ 0,
@@ -175,7 +424,7 @@ int main
               }
             else if (strcmp(pathtype, "cache") == 0)
               {
-                result = xdg_find_cache_path(itempath, true);
+                result = xdg_context_find_cache_path(ctx, itempath, true);
                 if (result == 0)
                   {
                     fprintf(stderr, "error %d -- %s\n", errno, strerror(errno));
@@ -183,11 +432,248 @@ int main
                     break;
                   } /*if*/
                 fprintf(stdout, "* %s\n", result);
+              }
+            else if (strcmp(pathtype, "runtime") == 0)
+              {
+                result = xdg_context_get_runtime_dir(ctx, false);
+                if (result == 0)
+                  {
+                    fprintf(stderr, "error %d -- %s\n", errno, strerror(errno));
+                    status = 2;
+                    break;
+                  } /*if*/
+                fprintf(stdout, "* %s/%s\n", result, itempath);
+              } /*if*/
+          }
+        else if (strcmp(op, "open") == 0)
+          {
+            char * path;
+            struct stat statinfo;
+            const int fd =
+                config ?
+                    xdg_context_open_first_config_path(ctx, itempath, O_RDONLY, &path)
+                :
+                    xdg_context_open_first_data_path(ctx, itempath, O_RDONLY, &path);
+            if (fd < 0)
+              {
+                fprintf(stderr, "error %d -- %s\n", errno, strerror(errno));
+                status = 2;
+                break;
+              } /*if*/
+            result = path;
+            if (fstat(fd, &statinfo) != 0)
+              {
+                fprintf(stderr, "error %d getting size -- %s\n", errno, strerror(errno));
+                close(fd);
+                status = 2;
+                break;
+              } /*if*/
+            fprintf(stdout, "%s %jd\n", result, (intmax_t)statinfo.st_size);
+            close(fd);
+          }
+        else if (strcmp(op, "prefetch") == 0)
+          {
+            int * const fds = calloc(nr_items, sizeof(int));
+            char ** const paths = calloc(nr_items, sizeof(char *));
+            int nr_found;
+            int i;
+            if (fds == 0 || paths == 0)
+              {
+                fprintf(stderr, "out of memory\n");
+                free(fds);
+                free(paths);
+                status = 2;
+                break;
+              } /*if*/
+            nr_found =
+                config ?
+                    xdg_context_prefetch_config_paths(ctx, itempaths, nr_items, O_RDONLY, fds, paths)
+                :
+                    xdg_context_prefetch_data_paths(ctx, itempaths, nr_items, O_RDONLY, fds, paths);
+            if (nr_found < 0)
+              {
+                fprintf(stderr, "error %d -- %s\n", errno, strerror(errno));
+                status = 2;
+              }
+            else
+              {
+                for (i = 0; i < nr_items; ++i)
+                  {
+                    fprintf(stdout, "%s: %s\n", itempaths[i], paths[i] != 0 ? paths[i] : "(not found)");
+                    if (fds[i] >= 0)
+                      {
+                        close(fds[i]);
+                      } /*if*/
+                    free(paths[i]);
+                  } /*for*/
+                fprintf(stdout, "%d found\n", nr_found);
+              } /*if*/
+            free(fds);
+            free(paths);
+          }
+        else if (strcmp(op, "variant") == 0 || strcmp(op, "variantc") == 0)
+          {
+            const xdg_variant_policy policy =
+                strcmp(op, "variant") == 0 ?
+                    XDG_VARIANT_DIRECTORY_MAJOR
+                :
+                    XDG_VARIANT_CANDIDATE_MAJOR;
+            int which;
+            result =
+                config ?
+                    xdg_context_find_first_variant_config_path(ctx, itempaths, policy, &which)
+                :
+                    xdg_context_find_first_variant_data_path(ctx, itempaths, policy, &which);
+            if (nr_items == 1)
+              {
+              /* should agree with single-item lookup */
+                char * const single =
+                    config ?
+                        xdg_context_find_first_config_path(ctx, itempath)
+                    :
+                        xdg_context_find_first_data_path(ctx, itempath);
+                if
+                  (
+                        (result == 0) != (single == 0)
+                    ||
+                        (result != 0 && strcmp(result, single) != 0)
+                  )
+                  {
+                    fprintf
+                      (
+                        stderr,
+                        "mismatch: variant lookup gives %s, single lookup gives %s\n",
+                        result != 0 ? result : "(not found)",
+                        single != 0 ? single : "(not found)"
+                      );
+                    status = 3;
+                  } /*if*/
+                free(single);
+                if (status != 0)
+                    break;
+              } /*if*/
+            if (result == 0)
+              {
+                fprintf(stderr, "error %d -- %s\n", errno, strerror(errno));
+                status = 2;
+                break;
+              } /*if*/
+            fprintf(stdout, "%s [%d]\n", result, which);
+          }
+        else if (strcmp(op, "blobput") == 0 || strcmp(op, "blobget") == 0)
+          {
+            xdg_blob_store * const store = xdg_context_blob_store_open(ctx, itempath, 0);
+            unsigned char digest[XDG_BLOB_DIGEST_SIZE];
+            int i;
+            if (store == 0)
+              {
+                fprintf(stderr, "error %d opening blob store -- %s\n", errno, strerror(errno));
+                status = 2;
+                break;
+              } /*if*/
+            if (strcmp(op, "blobput") == 0)
+              {
+                char * data = 0;
+                size_t data_len = 0;
+                size_t data_alloc = 0;
+                size_t nr_read;
+                for (;;)
+                  {
+                    if (data_len == data_alloc)
+                      {
+                        char * const new_data = realloc(data, data_alloc + 65536);
+                        if (new_data == 0)
+                          {
+                            fprintf(stderr, "out of memory\n");
+                            status = 2;
+                            break;
+                          } /*if*/
+                        data = new_data;
+                        data_alloc += 65536;
+                      } /*if*/
+                    nr_read = fread(data + data_len, 1, data_alloc - data_len, stdin);
+                    if (nr_read == 0)
+                        break;
+                    data_len += nr_read;
+                  } /*for*/
+                if (status == 0)
+                  {
+                    if (xdg_blob_store_put(store, data, data_len, digest) == 0)
+                      {
+                        for (i = 0; i < XDG_BLOB_DIGEST_SIZE; ++i)
+                          {
+                            fprintf(stdout, "%02x", digest[i]);
+                          } /*for*/
+                        fputs("\n", stdout);
+                      }
+                    else
+                      {
+                        fprintf(stderr, "error %d storing -- %s\n", errno, strerror(errno));
+                        status = 2;
+                      } /*if*/
+                  } /*if*/
+                free(data);
+              }
+            else if (parse_digest(itempaths[1], digest) != 0)
+              {
+                fprintf(stderr, "invalid digest %s\n", itempaths[1]);
+                status = 1;
+              }
+            else
+              {
+                size_t data_len;
+                const void * const data = xdg_blob_store_get(store, digest, &data_len);
+                if (data != 0)
+                  {
+                    fwrite(data, 1, data_len, stdout);
+                    xdg_blob_store_release(data, data_len);
+                  }
+                else
+                  {
+                    fprintf(stderr, "error %d -- %s\n", errno, strerror(errno));
+                    status = 2;
+                  } /*if*/
+              } /*if*/
+            xdg_blob_store_close(store);
+          }
+        else if (strcmp(op, "export") == 0)
+          {
+            char ** command;
+            char fdstr[16];
+            int fd;
+            for (command = argv + optind + 2; *command != 0 && strcmp(*command, "--") != 0; ++command)
+              /* just look for end of paths */;
+            if (*command == 0 || command[1] == 0)
+              {
+                fprintf(stderr, "export needs a command to run after \"--\"\n");
+                status = 1;
+                break;
+              } /*if*/
+            *command++ = 0; /* terminate item list */
+            fd = xdg_context_export
+              (
+                /*ctx =*/ ctx,
+                /*config_items =*/ config ? itempaths : 0,
+                /*data_items =*/ config ? 0 : itempaths
+              );
+            if (fd < 0)
+              {
+                fprintf(stderr, "error %d exporting -- %s\n", errno, strerror(errno));
+                status = 2;
+                break;
               } /*if*/
+            snprintf(fdstr, sizeof fdstr, "%d", fd);
+            setenv(XDG_CONTEXT_FD_ENV, fdstr, 1);
+            fflush(stdout);
+            execvp(command[0], command);
+            fprintf(stderr, "error %d running %s -- %s\n", errno, command[0], strerror(errno));
+            status = 2;
           } /*if*/
       }
     while (false);
     free((void *)result);
+    xdg_context_dispose(ctx);
+    xdg_fs_backend_dispose(backend);
     return
         status;
   } /*main*/
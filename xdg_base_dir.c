@@ -10,7 +10,22 @@
 
 #define _GNU_SOURCE
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <pwd.h>
+#include <pthread.h>
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
@@ -40,479 +55,5029 @@ static void strconcat
     dest[destlen + srclen] = 0;
   } /*strconcat*/
 
-/*
-    User-visible stuff
-*/
+static char * path_join
+  (
+    const char * dir,
+    const char * item
+  )
+  /* returns dir and item joined with a slash (unless dir is empty or already ends
+    with one), or NULL if out of memory. Caller must dispose of the result pointer. */
+  {
+    const size_t result_maxlen = strlen(dir) + 1 + strlen(item) + 1;
+    char * const result = malloc(result_maxlen);
+    if (result != 0)
+      {
+        strncpy(result, dir, result_maxlen);
+        if (result[0] != '\0' && result[strlen(result) - 1] != '/')
+          {
+            strconcat(result, result_maxlen, "/");
+          } /*if*/
+        strconcat(result, result_maxlen, item);
+      } /*if*/
+    return
+        result;
+  } /*path_join*/
 
-int xdg_makedirsif
+static int check_runtime_dir
   (
-    const char * path
+    const char * path,
+    uid_t owner
   )
-  /* creates all the directories in path, if they don't already exist. Returns
-    nonzero and sets errno on error. */
+  /* checks that path is an absolute path to an actual directory (not a symlink)
+    owned by owner and accessible only to it, as the spec requires for
+    $XDG_RUNTIME_DIR. Returns nonzero and sets errno if not. */
   {
-    int status;
-    const char * pathrest;
-    pathrest = path;
-    for (;;)
+    struct stat statinfo;
+    int status = -1;
+    do /*once*/
       {
-        const char * const segend = strchrnul(pathrest, '/');
-        if (segend > pathrest)
+        if (path[0] != '/')
           {
-            const char * const curdir = strndup(path, segend - path);
-            if (curdir == 0)
-              {
-                status = -1; /* assume errno is set to ENOMEM */
-                break;
-              } /*if*/
-            status = mkdir(curdir, 0700);
-            free((void *)curdir);
-            if (status != 0 && errno != EEXIST)
-                break;
+            errno = EINVAL;
+            break;
           } /*if*/
-        if (*segend == '\0')
+        if (lstat(path, &statinfo) != 0)
+            break;
+        if (!S_ISDIR(statinfo.st_mode))
           {
-            status = 0;
+            errno = ENOTDIR;
             break;
           } /*if*/
-        pathrest = segend + 1;
-      } /*for*/
+        if (statinfo.st_uid != owner || (statinfo.st_mode & 0777) != 0700)
+          {
+            errno = EACCES;
+            break;
+          } /*if*/
+        status = 0;
+      }
+    while (false);
     return
         status;
-  } /*xdg_makedirsif*/
+  } /*check_runtime_dir*/
 
-char * xdg_make_home_relative
+static char * runtime_item_path
   (
-    const char * path
+    const char * itempath,
+    bool makedirs
   )
-  /* prepends the value of $HOME onto path (assumed not to begin with a slash), or
-    NULL on error (out of memory, $HOME not defined or not absolute). Caller must dispose
-    of the result pointer. */
+  /* returns the expansion of itempath within the runtime directory, creating the
+    runtime directory and any intermediate directories in itempath if makedirs.
+    Caller must dispose of the result pointer. */
   {
-    const char * const home = getenv("HOME");
+    char * const runtime_dir = xdg_get_runtime_dir(makedirs);
     char * result = 0;
-    size_t result_len;
     do /*once*/
       {
-        if (home == 0 || home[0] != '/')
-          {
-            errno = ENOENT;
+        if (runtime_dir == 0)
             break;
-          } /*if*/
-      /* assert strlen(home) > 0 */
-        result_len = strlen(home) + 1 + strlen(path) + 1; /* worst case */
-        result = malloc(result_len);
+        result = path_join(runtime_dir, itempath);
         if (result == 0)
             break;
-        strncpy(result, home, result_len);
-        if (result[strlen(result) - 1] != '/')
+        if (makedirs)
           {
-            strconcat(result, result_len, "/");
+            char * const lastsep = strrchr(result, '/');
+            int status;
+            assert(lastsep != 0);
+            *lastsep = '\0';
+            status = xdg_makedirsif(result);
+            *lastsep = '/';
+            if (status != 0)
+              {
+                free(result);
+                result = 0;
+                break;
+              } /*if*/
           } /*if*/
-        strconcat(result, result_len, path);
       }
     while (false);
+    free(runtime_dir);
     return
         result;
-  } /*xdg_make_home_relative*/
+  } /*runtime_item_path*/
 
-char * xdg_get_config_home
+static int runtime_socket_addr
   (
+    struct sockaddr_un * addr,
+    const char * itempath,
     bool makedirs
   )
-  /* returns the directory for holding user-specific config files, or NULL on
-    error. Caller must dispose of the result pointer. */
+  /* fills in addr with the runtime-directory expansion of itempath. Returns nonzero
+    and sets errno on error. */
   {
-    char * result;
-    void * to_dispose = 0;
-    result = getenv("XDG_CONFIG_HOME");
-    if (result == 0)
+    char * const path = runtime_item_path(itempath, makedirs);
+    int status = -1;
+    if (path != 0)
       {
-        to_dispose = xdg_make_home_relative(".config");
-        result = to_dispose;
+        memset(addr, 0, sizeof *addr);
+        addr->sun_family = AF_UNIX;
+        if (strlen(path) < sizeof addr->sun_path)
+          {
+            strcpy(addr->sun_path, path);
+            status = 0;
+          }
+        else
+          {
+            errno = ENAMETOOLONG;
+          } /*if*/
+        free(path);
       } /*if*/
-    if (makedirs && xdg_makedirsif(result) != 0)
+    return
+        status;
+  } /*runtime_socket_addr*/
+
+static void close_keep_errno
+  (
+    int fd
+  )
+  /* closes fd if valid, without disturbing errno. */
+  {
+    if (fd >= 0)
       {
-        free(to_dispose);
-        result = 0;
+        const int save_errno = errno;
+        close(fd);
+        errno = save_errno;
       } /*if*/
-    if (result != 0 && to_dispose == 0)
+  } /*close_keep_errno*/
+
+/*
+    Filesystem backends
+*/
+
+static int posix_stat
+  (
+    xdg_fs_backend * self,
+    const char * path,
+    struct stat * statinfo
+  )
+  {
+    return
+        stat(path, statinfo);
+  } /*posix_stat*/
+
+static int posix_open
+  (
+    xdg_fs_backend * self,
+    const char * path,
+    int flags,
+    mode_t mode
+  )
+  {
+    return
+        open(path, flags, mode);
+  } /*posix_open*/
+
+static int posix_mkdir
+  (
+    xdg_fs_backend * self,
+    const char * path,
+    mode_t mode
+  )
+  {
+    return
+        mkdir(path, mode);
+  } /*posix_mkdir*/
+
+static int readdir_entries
+  (
+    DIR * dir,
+    xdg_dir_entry_action action,
+    void * actionarg
+  )
+  /* common internal routine for backend readdir operations: invokes action for each
+    entry in dir other than "." and "..", then closes dir. */
+  {
+    int status;
+    for (;;)
       {
-        result = strdup(result);
-      } /*if*/
+        const struct dirent * entry;
+        errno = 0;
+        entry = readdir(dir);
+        if (entry == 0)
+          {
+            status = errno != 0 ? -1 : 0;
+            break;
+          } /*if*/
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        status = action(entry->d_name, actionarg);
+        if (status != 0)
+            break;
+      } /*for*/
+      {
+        const int save_errno = errno;
+        closedir(dir);
+        errno = save_errno;
+      }
     return
-        result;
-  } /*xdg_get_config_home*/
+        status;
+  } /*readdir_entries*/
 
-char * xdg_get_data_home
+static int posix_readdir
   (
-    bool makedirs
+    xdg_fs_backend * self,
+    const char * path,
+    xdg_dir_entry_action action,
+    void * actionarg
   )
-  /* returns the directory for holding user-specific data files, or NULL on
-    error. Caller must dispose of the result pointer. */
   {
-    char * result;
-    void * to_dispose = 0;
-    result = getenv("XDG_DATA_HOME");
-    if (result == 0)
+    DIR * const dir = opendir(path);
+    return
+        dir != 0 ? readdir_entries(dir, action, actionarg) : -1;
+  } /*posix_readdir*/
+
+static int posix_rename
+  (
+    xdg_fs_backend * self,
+    const char * oldpath,
+    const char * newpath
+  )
+  {
+    return
+        rename(oldpath, newpath);
+  } /*posix_rename*/
+
+static int posix_unlink
+  (
+    xdg_fs_backend * self,
+    const char * path
+  )
+  {
+    return
+        unlink(path);
+  } /*posix_unlink*/
+
+static xdg_fs_backend posix_backend =
+  {
+    .stat = posix_stat,
+    .open = posix_open,
+    .mkdir = posix_mkdir,
+    .readdir = posix_readdir,
+    .rename = posix_rename,
+    .unlink = posix_unlink,
+    .dispose = 0,
+  };
+
+struct sysroot_backend
+  {
+    xdg_fs_backend base; /* must be first */
+    int root_fd; /* O_PATH descriptor for the root of the tree */
+  };
+
+static int sysroot_openat
+  (
+    const struct sysroot_backend * sysroot,
+    const char * path,
+    int flags,
+    mode_t mode
+  )
+  /* opens path resolved entirely within the sysroot, as though the process had been
+    chrooted there: ".." components and symlinks, including absolute ones, cannot
+    lead outside it. */
+  {
+    struct open_how how;
+    memset(&how, 0, sizeof how);
+    how.flags = flags;
+    how.mode = (flags & (O_CREAT | O_TMPFILE)) != 0 ? mode : 0;
+    how.resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS;
+    return
+        syscall(SYS_openat2, sysroot->root_fd, path[0] != '\0' ? path : ".", &how, sizeof how);
+  } /*sysroot_openat*/
+
+static int sysroot_open_parent
+  (
+    const struct sysroot_backend * sysroot,
+    const char * path,
+    char * name /* of size PATH_MAX */
+  )
+  /* opens the directory containing the last component of path, resolved within the
+    sysroot, and puts that last component into name, so that operations that act on
+    the entry itself rather than following it can be done relative to the returned
+    fd. Returns -1 and sets errno on error. */
+  {
+    char parent[PATH_MAX];
+    size_t path_len = strlen(path);
+    const char * slash;
+    int fd = -1;
+    do /*once*/
       {
-        to_dispose = xdg_make_home_relative(".local/share");
-        result = to_dispose;
-      } /*if*/
-    if (makedirs && xdg_makedirsif(result) != 0)
+        while (path_len > 1 && path[path_len - 1] == '/')
+          {
+            --path_len; /* ignore trailing slashes */
+          } /*while*/
+        if (path_len >= PATH_MAX)
+          {
+            errno = ENAMETOOLONG;
+            break;
+          } /*if*/
+        memcpy(parent, path, path_len);
+        parent[path_len] = '\0';
+        slash = strrchr(parent, '/');
+        if (slash != 0)
+          {
+            strcpy(name, slash + 1);
+            parent[slash - parent + (slash == parent)] = '\0'; /* keep root slash */
+          }
+        else
+          {
+            strcpy(name, parent);
+            strcpy(parent, ".");
+          } /*if*/
+        if (name[0] == '\0')
+          {
+            errno = EINVAL; /* path is the root itself */
+            break;
+          } /*if*/
+        fd = sysroot_openat(sysroot, parent, O_PATH | O_DIRECTORY | O_CLOEXEC, 0);
+      }
+    while (false);
+    return
+        fd;
+  } /*sysroot_open_parent*/
+
+static int sysroot_stat
+  (
+    xdg_fs_backend * self,
+    const char * path,
+    struct stat * statinfo
+  )
+  {
+    const int fd = sysroot_openat((const struct sysroot_backend *)self, path, O_PATH | O_CLOEXEC, 0);
+    int status = -1;
+    if (fd >= 0)
       {
-        free(to_dispose);
-        result = 0;
+        status = fstat(fd, statinfo);
+        close_keep_errno(fd);
       } /*if*/
-    if (result != 0 && to_dispose == 0)
+    return
+        status;
+  } /*sysroot_stat*/
+
+static int sysroot_open
+  (
+    xdg_fs_backend * self,
+    const char * path,
+    int flags,
+    mode_t mode
+  )
+  {
+    return
+        sysroot_openat((const struct sysroot_backend *)self, path, flags, mode);
+  } /*sysroot_open*/
+
+static int sysroot_mkdir
+  (
+    xdg_fs_backend * self,
+    const char * path,
+    mode_t mode
+  )
+  {
+    char name[PATH_MAX];
+    const int fd = sysroot_open_parent((const struct sysroot_backend *)self, path, name);
+    int status = -1;
+    if (fd >= 0)
       {
-        result = strdup(result);
+        status = mkdirat(fd, name, mode);
+        close_keep_errno(fd);
       } /*if*/
     return
-        result;
-  } /*xdg_get_data_home*/
+        status;
+  } /*sysroot_mkdir*/
 
-char * xdg_get_cache_home
+static int sysroot_readdir
   (
-    bool makedirs
+    xdg_fs_backend * self,
+    const char * path,
+    xdg_dir_entry_action action,
+    void * actionarg
   )
-  /* returns the directory for holding user-specific cache files, or NULL on
-    error. Caller must dispose of the result pointer. */
   {
-    char * result;
-    void * to_dispose = 0;
-    result = getenv("XDG_CACHE_HOME");
-    if (result == 0)
+    const int fd = sysroot_openat
+      (
+        /*sysroot =*/ (const struct sysroot_backend *)self,
+        /*path =*/ path,
+        /*flags =*/ O_RDONLY | O_DIRECTORY | O_CLOEXEC,
+        /*mode =*/ 0
+      );
+    DIR * dir = 0;
+    int status = -1;
+    if (fd >= 0)
       {
-        to_dispose = xdg_make_home_relative(".cache");
-        result = to_dispose;
+        dir = fdopendir(fd);
+        if (dir != 0)
+          {
+            status = readdir_entries(dir, action, actionarg);
+          }
+        else
+          {
+            close_keep_errno(fd);
+          } /*if*/
       } /*if*/
-    if (makedirs && xdg_makedirsif(result) != 0)
+    return
+        status;
+  } /*sysroot_readdir*/
+
+static int sysroot_rename
+  (
+    xdg_fs_backend * self,
+    const char * oldpath,
+    const char * newpath
+  )
+  {
+    const struct sysroot_backend * const sysroot = (const struct sysroot_backend *)self;
+    char oldname[PATH_MAX];
+    char newname[PATH_MAX];
+    const int oldfd = sysroot_open_parent(sysroot, oldpath, oldname);
+    const int newfd = oldfd >= 0 ? sysroot_open_parent(sysroot, newpath, newname) : -1;
+    int status = -1;
+    if (newfd >= 0)
       {
-        free(to_dispose);
-        result = 0;
+        status = renameat(oldfd, oldname, newfd, newname);
+        close_keep_errno(newfd);
       } /*if*/
-    if (result != 0 && to_dispose == 0)
+    if (oldfd >= 0)
       {
-        result = strdup(result);
+        close_keep_errno(oldfd);
       } /*if*/
     return
-        result;
-  } /*xdg_get_cache_home*/
+        status;
+  } /*sysroot_rename*/
 
-char * xdg_config_search_path(void)
-  /* returns a string containing the colon-separated list of config directories to search
-    (apart from the user area). Caller must dispose of the result pointer. */
+static int sysroot_unlink
+  (
+    xdg_fs_backend * self,
+    const char * path
+  )
   {
-    char * result = getenv("XDG_CONFIG_DIRS");
-    if (result == 0)
+    char name[PATH_MAX];
+    const int fd = sysroot_open_parent((const struct sysroot_backend *)self, path, name);
+    int status = -1;
+    if (fd >= 0)
       {
-        result = "/etc";
-          /* note spec actually says default should be /etc/xdg, but /etc is the
-            conventional location for system config files. */
+        status = unlinkat(fd, name, 0);
+        close_keep_errno(fd);
       } /*if*/
-    return strdup(result);
-  } /*xdg_config_search_path*/
+    return
+        status;
+  } /*sysroot_unlink*/
 
-char * xdg_data_search_path(void)
-  /* returns a string containing the colon-separated list of data directories to search
-    (apart from the user area). Caller must dispose of the result pointer. */
+static void sysroot_dispose
+  (
+    xdg_fs_backend * self
+  )
   {
-    char * result = getenv("XDG_DATA_DIRS");
-    if (result == 0)
+    close(((struct sysroot_backend *)self)->root_fd);
+    free(self);
+  } /*sysroot_dispose*/
+
+struct memfs_node
+  {
+    struct memfs_node * hash_next; /* in hash bucket */
+    struct memfs_node * parent;
+    struct memfs_node * first_child;
+    struct memfs_node * next_sibling;
+    mode_t mode;
+    off_t size;
+    struct timespec mtime;
+    ino_t ino;
+    size_t hash;
+    const char * name; /* last component, points into path */
+    char path[]; /* normalized absolute path */
+  };
+
+struct memfs_backend
+  {
+    xdg_fs_backend base; /* must be first */
+    pthread_mutex_t lock;
+    struct memfs_node ** buckets;
+    size_t nr_buckets; /* always a power of 2 */
+    size_t nr_nodes;
+    ino_t next_ino;
+  };
+
+static size_t path_hash
+  (
+    const char * path,
+    size_t path_len
+  )
+  /* FNV-1a hash of a path or name. */
+  {
+    size_t result = (size_t)14695981039346656037ULL;
+    for (; path_len != 0; --path_len)
       {
-        result = "/usr/local/share:/usr/share";
-      } /*if*/
+        result = (result ^ (unsigned char)*path++) * (size_t)1099511628211ULL;
+      } /*for*/
     return
-        strdup(result);
-  } /*xdg_data_search_path*/
+        result;
+  } /*path_hash*/
 
-int xdg_for_each_path_component
+static int memfs_normalize
   (
-    const unsigned char * path,
-    size_t path_len,
-    xdg_path_component_action action,
-    void * actionarg,
-    bool forwards /* false to do in reverse */
+    const char * path,
+    char * dest, /* of size PATH_MAX */
+    size_t * dest_len
   )
-  /* splits the string path with len path_len at any colon separators, calling
-    action for each component found, in forward or reverse order as specified.
-    Returns nonzero on error, or if action returned nonzero. */
+  /* puts the canonical form of path into dest: absolute, no empty, "." or ".."
+    components, and no trailing slash except for the root itself. Relative paths
+    are taken as relative to the root. Returns nonzero and sets errno if the
+    result is too long. */
   {
-    int status;
-    const unsigned char * const path_end = path + path_len;
-    const unsigned char * path_prev;
-    const unsigned char * path_next;
-    if (forwards)
-      {
-        path_prev = path;
-        for (;;)
+    size_t len = 0;
+    int status = 0;
+    for (;;)
+      {
+        const char * segend;
+        size_t seglen;
+        while (*path == '/')
           {
-            path_next = path_prev;
-            for (;;)
+            ++path;
+          } /*while*/
+        if (*path == '\0')
+            break;
+        segend = strchrnul(path, '/');
+        seglen = segend - path;
+        if (seglen == 1 && path[0] == '.')
+          {
+          /* skip */
+          }
+        else if (seglen == 2 && path[0] == '.' && path[1] == '.')
+          {
+            while (len != 0 && dest[len - 1] != '/')
               {
-                if (path_next == path_end)
-                    break;
-                if (*path_next == ':')
-                    break;
-                ++path_next;
-              } /*for*/
-            status = action(path_prev, path_next - path_prev, actionarg);
-            if (status != 0)
+                --len;
+              } /*while*/
+            if (len != 0)
+              {
+                --len; /* drop the slash too */
+              } /*if*/
+          }
+        else
+          {
+            if (len + 1 + seglen >= PATH_MAX)
+              {
+                errno = ENAMETOOLONG;
+                status = -1;
                 break;
-            if (path_next == path_end)
+              } /*if*/
+            dest[len++] = '/';
+            memcpy(dest + len, path, seglen);
+            len += seglen;
+          } /*if*/
+        path = segend;
+      } /*for*/
+    if (status == 0)
+      {
+        if (len == 0)
+          {
+            dest[len++] = '/';
+          } /*if*/
+        dest[len] = '\0';
+        *dest_len = len;
+      } /*if*/
+    return
+        status;
+  } /*memfs_normalize*/
+
+static struct memfs_node * memfs_lookup
+  (
+    const struct memfs_backend * memfs,
+    const char * path, /* normalized */
+    size_t path_len
+  )
+  /* returns the node with the specified path, or NULL if none. Caller must hold
+    memfs->lock. */
+  {
+    const size_t hash = path_hash(path, path_len);
+    struct memfs_node * node;
+    for
+      (
+        node = memfs->buckets[hash & (memfs->nr_buckets - 1)];
+        node != 0;
+        node = node->hash_next
+      )
+      {
+        if (node->hash == hash && memcmp(node->path, path, path_len + 1) == 0)
+            break;
+      } /*for*/
+    return
+        node;
+  } /*memfs_lookup*/
+
+static struct memfs_node * memfs_create
+  (
+    struct memfs_backend * memfs,
+    const char * path, /* normalized */
+    size_t path_len,
+    mode_t mode,
+    off_t size
+  )
+  /* creates a new node with the specified path, whose parent must already exist
+    as a directory and which must not itself exist. Returns NULL and sets errno on
+    error. Caller must hold memfs->lock. */
+  {
+    struct memfs_node * parent = 0;
+    struct memfs_node * result = 0;
+    do /*once*/
+      {
+        if (path_len > 1)
+          {
+            size_t parent_len = path_len;
+            while (path[parent_len - 1] != '/')
+              {
+                --parent_len;
+              } /*while*/
+            if (parent_len > 1)
+              {
+                --parent_len; /* drop trailing slash except for root */
+              } /*if*/
+              {
+                char parent_path[PATH_MAX];
+                memcpy(parent_path, path, parent_len);
+                parent_path[parent_len] = '\0';
+                parent = memfs_lookup(memfs, parent_path, parent_len);
+              }
+            if (parent == 0)
+              {
+                errno = ENOENT;
                 break;
-            path_prev = path_next + 1;
-          } /*for*/
+              } /*if*/
+            if (!S_ISDIR(parent->mode))
+              {
+                errno = ENOTDIR;
+                break;
+              } /*if*/
+          } /*if*/
+        if (memfs->nr_nodes >= memfs->nr_buckets)
+          {
+            const size_t new_nr_buckets = memfs->nr_buckets * 2;
+            struct memfs_node ** const new_buckets =
+                calloc(new_nr_buckets, sizeof(struct memfs_node *));
+            size_t i;
+            if (new_buckets == 0)
+                break;
+            for (i = 0; i < memfs->nr_buckets; ++i)
+              {
+                struct memfs_node * node = memfs->buckets[i];
+                while (node != 0)
+                  {
+                    struct memfs_node * const next = node->hash_next;
+                    node->hash_next = new_buckets[node->hash & (new_nr_buckets - 1)];
+                    new_buckets[node->hash & (new_nr_buckets - 1)] = node;
+                    node = next;
+                  } /*while*/
+              } /*for*/
+            free(memfs->buckets);
+            memfs->buckets = new_buckets;
+            memfs->nr_buckets = new_nr_buckets;
+          } /*if*/
+        result = malloc(sizeof(struct memfs_node) + path_len + 1);
+        if (result == 0)
+            break;
+        memcpy(result->path, path, path_len + 1);
+        result->name = strrchr(result->path, '/') + 1;
+        result->hash = path_hash(path, path_len);
+        result->mode = mode;
+        result->size = size;
+        clock_gettime(CLOCK_REALTIME, &result->mtime);
+        result->ino = ++memfs->next_ino;
+        result->first_child = 0;
+        result->parent = parent;
+        if (parent != 0)
+          {
+            result->next_sibling = parent->first_child;
+            parent->first_child = result;
+            parent->mtime = result->mtime;
+          }
+        else
+          {
+            result->next_sibling = 0;
+          } /*if*/
+        result->hash_next = memfs->buckets[result->hash & (memfs->nr_buckets - 1)];
+        memfs->buckets[result->hash & (memfs->nr_buckets - 1)] = result;
+        ++memfs->nr_nodes;
       }
-    else /* backwards */
+    while (false);
+    return
+        result;
+  } /*memfs_create*/
+
+static int memfs_stat
+  (
+    xdg_fs_backend * self,
+    const char * path,
+    struct stat * statinfo
+  )
+  {
+    struct memfs_backend * const memfs = (struct memfs_backend *)self;
+    char normpath[PATH_MAX];
+    size_t normpath_len;
+    int status = -1;
+    if (memfs_normalize(path, normpath, &normpath_len) == 0)
       {
-        path_next = path_end;
-        for (;;)
+        const struct memfs_node * node;
+        pthread_mutex_lock(&memfs->lock);
+        node = memfs_lookup(memfs, normpath, normpath_len);
+        if (node != 0)
           {
-            path_prev = path_next;
-            for (;;)
+            memset(statinfo, 0, sizeof *statinfo);
+            statinfo->st_ino = node->ino;
+            statinfo->st_mode = node->mode;
+            statinfo->st_nlink = 1;
+            statinfo->st_size = node->size;
+            statinfo->st_mtim = node->mtime;
+            statinfo->st_ctim = node->mtime;
+            statinfo->st_atim = node->mtime;
+            status = 0;
+          }
+        else
+          {
+            errno = ENOENT;
+          } /*if*/
+        pthread_mutex_unlock(&memfs->lock);
+      } /*if*/
+    return
+        status;
+  } /*memfs_stat*/
+
+static int memfs_open
+  (
+    xdg_fs_backend * self,
+    const char * path,
+    int flags,
+    mode_t mode
+  )
+  /* files have no contents, so what is returned is an anonymous file of the
+    recorded size, reading as all zeroes. */
+  {
+    struct memfs_backend * const memfs = (struct memfs_backend *)self;
+    char normpath[PATH_MAX];
+    size_t normpath_len;
+    off_t size = -1;
+    int fd = -1;
+    if (memfs_normalize(path, normpath, &normpath_len) == 0)
+      {
+        struct memfs_node * node;
+        pthread_mutex_lock(&memfs->lock);
+        do /*once*/
+          {
+            node = memfs_lookup(memfs, normpath, normpath_len);
+            if (node == 0)
               {
-                if (path_prev == path)
-                    break;
-                --path_prev;
-                if (*path_prev == ':')
+                if ((flags & O_CREAT) == 0)
                   {
-                    ++path_prev;
+                    errno = ENOENT;
                     break;
                   } /*if*/
+                node = memfs_create(memfs, normpath, normpath_len, S_IFREG | (mode & 07777), 0);
+                if (node == 0)
+                    break;
+              }
+            else if ((flags & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+              {
+                errno = EEXIST;
+                break;
+              } /*if*/
+            if (S_ISDIR(node->mode))
+              {
+                errno = EISDIR;
+                break;
+              } /*if*/
+            if ((flags & O_TRUNC) != 0 && (flags & O_ACCMODE) != O_RDONLY)
+              {
+                node->size = 0;
+              } /*if*/
+            size = node->size;
+          }
+        while (false);
+        pthread_mutex_unlock(&memfs->lock);
+      } /*if*/
+    if (size >= 0)
+      {
+        fd = memfd_create(normpath, (flags & O_CLOEXEC) != 0 ? MFD_CLOEXEC : 0);
+        if (fd >= 0 && ftruncate(fd, size) != 0)
+          {
+            close_keep_errno(fd);
+            fd = -1;
+          } /*if*/
+      } /*if*/
+    return
+        fd;
+  } /*memfs_open*/
+
+static int memfs_mkdir
+  (
+    xdg_fs_backend * self,
+    const char * path,
+    mode_t mode
+  )
+  {
+    struct memfs_backend * const memfs = (struct memfs_backend *)self;
+    char normpath[PATH_MAX];
+    size_t normpath_len;
+    int status = -1;
+    if (memfs_normalize(path, normpath, &normpath_len) == 0)
+      {
+        pthread_mutex_lock(&memfs->lock);
+        if (memfs_lookup(memfs, normpath, normpath_len) != 0)
+          {
+            errno = EEXIST;
+          }
+        else if (memfs_create(memfs, normpath, normpath_len, S_IFDIR | (mode & 07777), 0) != 0)
+          {
+            status = 0;
+          } /*if*/
+        pthread_mutex_unlock(&memfs->lock);
+      } /*if*/
+    return
+        status;
+  } /*memfs_mkdir*/
+
+static int memfs_readdir
+  (
+    xdg_fs_backend * self,
+    const char * path,
+    xdg_dir_entry_action action,
+    void * actionarg
+  )
+  {
+    struct memfs_backend * const memfs = (struct memfs_backend *)self;
+    char normpath[PATH_MAX];
+    size_t normpath_len;
+    char * names = 0; /* copied out so action is not called with lock held */
+    size_t names_len = 0;
+    int status = -1;
+    if (memfs_normalize(path, normpath, &normpath_len) == 0)
+      {
+        const struct memfs_node * node;
+        pthread_mutex_lock(&memfs->lock);
+        do /*once*/
+          {
+            const struct memfs_node * child;
+            char * nextname;
+            node = memfs_lookup(memfs, normpath, normpath_len);
+            if (node == 0)
+              {
+                errno = ENOENT;
+                break;
+              } /*if*/
+            if (!S_ISDIR(node->mode))
+              {
+                errno = ENOTDIR;
+                break;
+              } /*if*/
+            for (child = node->first_child; child != 0; child = child->next_sibling)
+              {
+                names_len += strlen(child->name) + 1;
               } /*for*/
-            status = action(path_prev, path_next - path_prev, actionarg);
-            if (status != 0)
+            names = malloc(names_len + 1);
+            if (names == 0)
                 break;
-            if (path_prev == path)
+            nextname = names;
+            for (child = node->first_child; child != 0; child = child->next_sibling)
+              {
+                strcpy(nextname, child->name);
+                nextname += strlen(nextname) + 1;
+              } /*for*/
+            status = 0;
+          }
+        while (false);
+        pthread_mutex_unlock(&memfs->lock);
+      } /*if*/
+    if (status == 0)
+      {
+        const char * name;
+        for (name = names; name < names + names_len; name += strlen(name) + 1)
+          {
+            status = action(name, actionarg);
+            if (status != 0)
                 break;
-            path_next = path_prev - 1;
           } /*for*/
       } /*if*/
-    return status;
-  } /*xdg_for_each_path_component*/
+    free(names);
+    return
+        status;
+  } /*memfs_readdir*/
+
+static void memfs_remove
+  (
+    struct memfs_backend * memfs,
+    struct memfs_node * node
+  )
+  /* removes node, which must not be the root or have any children, from the tree
+    and disposes of it. Caller must hold memfs->lock. */
+  {
+    struct memfs_node ** prev;
+    assert(node->parent != 0 && node->first_child == 0);
+    prev = &memfs->buckets[node->hash & (memfs->nr_buckets - 1)];
+    while (*prev != node)
+      {
+        prev = &(*prev)->hash_next;
+      } /*while*/
+    *prev = node->hash_next;
+    prev = &node->parent->first_child;
+    while (*prev != node)
+      {
+        prev = &(*prev)->next_sibling;
+      } /*while*/
+    *prev = node->next_sibling;
+    clock_gettime(CLOCK_REALTIME, &node->parent->mtime);
+    --memfs->nr_nodes;
+    free(node);
+  } /*memfs_remove*/
+
+static int memfs_rename
+  (
+    xdg_fs_backend * self,
+    const char * oldpath,
+    const char * newpath
+  )
+  /* only files can be renamed: directories fail with EXDEV, as they would when
+    crossing filesystems, since their descendants would all have to be rehashed. */
+  {
+    struct memfs_backend * const memfs = (struct memfs_backend *)self;
+    char normoldpath[PATH_MAX];
+    char normnewpath[PATH_MAX];
+    size_t normoldpath_len;
+    size_t normnewpath_len;
+    int status = -1;
+    if
+      (
+            memfs_normalize(oldpath, normoldpath, &normoldpath_len) == 0
+        &&
+            memfs_normalize(newpath, normnewpath, &normnewpath_len) == 0
+      )
+      {
+        pthread_mutex_lock(&memfs->lock);
+        do /*once*/
+          {
+            struct memfs_node * const oldnode = memfs_lookup(memfs, normoldpath, normoldpath_len);
+            struct memfs_node * newnode;
+            if (oldnode == 0)
+              {
+                errno = ENOENT;
+                break;
+              } /*if*/
+            if (S_ISDIR(oldnode->mode))
+              {
+                errno = EXDEV;
+                break;
+              } /*if*/
+            newnode = memfs_lookup(memfs, normnewpath, normnewpath_len);
+            if (newnode == oldnode)
+              {
+                status = 0;
+                break;
+              } /*if*/
+            if (newnode != 0)
+              {
+                if (S_ISDIR(newnode->mode))
+                  {
+                    errno = EISDIR;
+                    break;
+                  } /*if*/
+                memfs_remove(memfs, newnode);
+              } /*if*/
+            newnode = memfs_create
+              (
+                /*memfs =*/ memfs,
+                /*path =*/ normnewpath,
+                /*path_len =*/ normnewpath_len,
+                /*mode =*/ oldnode->mode,
+                /*size =*/ oldnode->size
+              );
+            if (newnode == 0)
+                break;
+            memfs_remove(memfs, oldnode);
+            status = 0;
+          }
+        while (false);
+        pthread_mutex_unlock(&memfs->lock);
+      } /*if*/
+    return
+        status;
+  } /*memfs_rename*/
+
+static int memfs_unlink
+  (
+    xdg_fs_backend * self,
+    const char * path
+  )
+  {
+    struct memfs_backend * const memfs = (struct memfs_backend *)self;
+    char normpath[PATH_MAX];
+    size_t normpath_len;
+    int status = -1;
+    if (memfs_normalize(path, normpath, &normpath_len) == 0)
+      {
+        struct memfs_node * node;
+        pthread_mutex_lock(&memfs->lock);
+        node = memfs_lookup(memfs, normpath, normpath_len);
+        if (node == 0)
+          {
+            errno = ENOENT;
+          }
+        else if (S_ISDIR(node->mode))
+          {
+            errno = EISDIR;
+          }
+        else
+          {
+            memfs_remove(memfs, node);
+            status = 0;
+          } /*if*/
+        pthread_mutex_unlock(&memfs->lock);
+      } /*if*/
+    return
+        status;
+  } /*memfs_unlink*/
+
+static void memfs_dispose
+  (
+    xdg_fs_backend * self
+  )
+  {
+    struct memfs_backend * const memfs = (struct memfs_backend *)self;
+    size_t i;
+    for (i = 0; i < memfs->nr_buckets; ++i)
+      {
+        struct memfs_node * node = memfs->buckets[i];
+        while (node != 0)
+          {
+            struct memfs_node * const next = node->hash_next;
+            free(node);
+            node = next;
+          } /*while*/
+      } /*for*/
+    free(memfs->buckets);
+    pthread_mutex_destroy(&memfs->lock);
+    free(memfs);
+  } /*memfs_dispose*/
+
+static int makedirsif
+  (
+    xdg_fs_backend * backend,
+    const char * path
+  )
+  /* common internal routine for xdg_makedirsif that goes through the specified
+    backend. */
+  {
+    int status;
+    const char * pathrest;
+    pathrest = path;
+    for (;;)
+      {
+        const char * const segend = strchrnul(pathrest, '/');
+        if (segend > pathrest)
+          {
+            const char * const curdir = strndup(path, segend - path);
+            if (curdir == 0)
+              {
+                status = -1; /* assume errno is set to ENOMEM */
+                break;
+              } /*if*/
+            status = backend->mkdir(backend, curdir, 0700);
+            free((void *)curdir);
+            if (status != 0 && errno != EEXIST)
+                break;
+          } /*if*/
+        if (*segend == '\0')
+          {
+            status = 0;
+            break;
+          } /*if*/
+        pathrest = segend + 1;
+      } /*for*/
+    return
+        status;
+  } /*makedirsif*/
+
+/*
+    Resolution contexts
+*/
+
+enum /* per-user variables that a context can set explicitly */
+  {
+    XDG_VAR_CONFIG_HOME,
+    XDG_VAR_DATA_HOME,
+    XDG_VAR_CACHE_HOME,
+    XDG_VAR_RUNTIME_DIR,
+    XDG_NR_USER_VARS, /* must be last */
+  };
+
+static const char * const user_var_names[XDG_NR_USER_VARS] =
+  {
+    "XDG_CONFIG_HOME",
+    "XDG_DATA_HOME",
+    "XDG_CACHE_HOME",
+    "XDG_RUNTIME_DIR",
+  };
+
+#define DEFAULT_CONFIG_DIRS "/etc"
+  /* note spec actually says default should be /etc/xdg, but /etc is the
+    conventional location for system config files. */
+#define DEFAULT_DATA_DIRS "/usr/local/share:/usr/share"
+
+enum /* states of a dir_listing */
+  {
+    LISTING_UNKNOWN, /* couldn't be listed, so can't rule anything out */
+    LISTING_ABSENT, /* directory doesn't exist, so nothing is in it */
+    LISTING_PRESENT, /* entries are as listed */
+  };
+
+struct dir_listing
+  /* what is known about the entries in a system search directory. */
+  {
+    bool listed; /* false if not looked at yet */
+    bool racy; /* modified too recently to trust mtime for detecting further changes */
+    int state; /* LISTING_xxx */
+    struct timespec checked; /* monotonic time of last check against directory */
+    struct timespec mtime; /* of directory when entries were read */
+    size_t nr_names;
+    size_t * name_hashes; /* sorted path_hash values of entry names */
+  };
+
+struct xdg_system
+  /* state for searching a particular set of system config and data directories.
+    One of these is shared by all contexts that see the same set, so anything
+    kept about those directories is only kept once. */
+  {
+    struct xdg_system * next; /* in systems list */
+    unsigned int refcount; /* protected by systems_lock */
+    xdg_fs_backend * backend;
+    const char * config_dirs; /* colon-separated, points into strings */
+    const char * data_dirs; /* colon-separated, points into strings */
+    pthread_mutex_t listings_lock;
+    size_t nr_dirs[2]; /* indexed by config: [false] for data, [true] for config */
+    struct dir_listing * listings[2];
+      /* one per search directory, indexed likewise; protected by listings_lock */
+    char strings[];
+  };
+
+static struct xdg_system * systems = 0; /* all currently-referenced system states */
+static struct xdg_system * env_system = 0;
+  /* reference kept to the one matching the process environment, so it survives
+    between calls on the default context */
+static pthread_mutex_t systems_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct xdg_context
+  {
+    struct xdg_system * system;
+    uid_t uid;
+    const char * home; /* points into strings */
+    const char * user_vars[XDG_NR_USER_VARS];
+      /* explicit settings pointing into strings, or NULL to use defaults */
+    char strings[];
+  };
+
+static size_t count_path_components
+  (
+    const char * path
+  )
+  /* returns the number of components xdg_for_each_path_component will find in path. */
+  {
+    size_t result = 1;
+    for (; *path != '\0'; ++path)
+      {
+        if (*path == ':')
+          {
+            ++result;
+          } /*if*/
+      } /*for*/
+    return
+        result;
+  } /*count_path_components*/
+
+static void system_dispose
+  (
+    struct xdg_system * sys
+  )
+  {
+    int config;
+    size_t i;
+    for (config = 0; config < 2; ++config)
+      {
+        if (sys->listings[config] != 0)
+          {
+            for (i = 0; i < sys->nr_dirs[config]; ++i)
+              {
+                free(sys->listings[config][i].name_hashes);
+              } /*for*/
+            free(sys->listings[config]);
+          } /*if*/
+      } /*for*/
+    pthread_mutex_destroy(&sys->listings_lock);
+    free(sys);
+  } /*system_dispose*/
+
+static struct xdg_system * system_acquire_locked
+  (
+    xdg_fs_backend * backend,
+    const char * config_dirs,
+    const char * data_dirs
+  )
+  /* returns a new reference to the system state for the specified backend and search
+    paths, creating it if necessary, or NULL if out of memory. Caller must hold
+    systems_lock. */
+  {
+    struct xdg_system * result;
+    for (result = systems; result != 0; result = result->next)
+      {
+        if
+          (
+                result->backend == backend
+            &&
+                strcmp(result->config_dirs, config_dirs) == 0
+            &&
+                strcmp(result->data_dirs, data_dirs) == 0
+          )
+            break;
+      } /*for*/
+    if (result == 0)
+      {
+        const size_t config_dirs_len = strlen(config_dirs) + 1;
+        const size_t data_dirs_len = strlen(data_dirs) + 1;
+        result = malloc(sizeof(struct xdg_system) + config_dirs_len + data_dirs_len);
+        if (result != 0)
+          {
+            memcpy(result->strings, config_dirs, config_dirs_len);
+            memcpy(result->strings + config_dirs_len, data_dirs, data_dirs_len);
+            result->config_dirs = result->strings;
+            result->data_dirs = result->strings + config_dirs_len;
+            result->backend = backend;
+            pthread_mutex_init(&result->listings_lock, 0);
+            result->nr_dirs[true] = count_path_components(result->config_dirs);
+            result->nr_dirs[false] = count_path_components(result->data_dirs);
+            result->listings[true] = calloc(result->nr_dirs[true], sizeof(struct dir_listing));
+            result->listings[false] = calloc(result->nr_dirs[false], sizeof(struct dir_listing));
+            if (result->listings[true] == 0 || result->listings[false] == 0)
+              {
+                system_dispose(result);
+                result = 0;
+              } /*if*/
+          } /*if*/
+        if (result != 0)
+          {
+            result->refcount = 0;
+            result->next = systems;
+            systems = result;
+          } /*if*/
+      } /*if*/
+    if (result != 0)
+      {
+        ++result->refcount;
+      } /*if*/
+    return
+        result;
+  } /*system_acquire_locked*/
+
+static void system_release_locked
+  (
+    struct xdg_system * sys
+  )
+  /* releases a reference to sys, disposing of it if that was the last one. Caller
+    must hold systems_lock. */
+  {
+    assert(sys->refcount != 0);
+    --sys->refcount;
+    if (sys->refcount == 0)
+      {
+        struct xdg_system ** prev = &systems;
+        while (*prev != sys)
+          {
+            prev = &(*prev)->next;
+          } /*while*/
+        *prev = sys->next;
+        system_dispose(sys);
+      } /*if*/
+  } /*system_release_locked*/
+
+static void system_release
+  (
+    struct xdg_system * sys
+  )
+  {
+    if (sys != 0)
+      {
+        pthread_mutex_lock(&systems_lock);
+        system_release_locked(sys);
+        pthread_mutex_unlock(&systems_lock);
+      } /*if*/
+  } /*system_release*/
+
+static struct xdg_system * context_system
+  (
+    const xdg_context * ctx
+  )
+  /* returns the system state applicable to ctx, or NULL if out of memory. Caller
+    must dispose of it with context_system_release. A context already holds a
+    reference to its own state for as long as it exists, so for a non-NULL ctx this
+    needs no locking; only the state for the calling process's environment, which
+    can be replaced at any time, has to be looked up under systems_lock. */
+  {
+    struct xdg_system * result;
+    if (ctx != 0)
+      {
+        result = ctx->system;
+      }
+    else
+      {
+        const char * config_dirs = getenv("XDG_CONFIG_DIRS");
+        const char * data_dirs = getenv("XDG_DATA_DIRS");
+        if (config_dirs == 0)
+          {
+            config_dirs = DEFAULT_CONFIG_DIRS;
+          } /*if*/
+        if (data_dirs == 0)
+          {
+            data_dirs = DEFAULT_DATA_DIRS;
+          } /*if*/
+        pthread_mutex_lock(&systems_lock);
+        if
+          (
+                env_system == 0
+            ||
+                strcmp(env_system->config_dirs, config_dirs) != 0
+            ||
+                strcmp(env_system->data_dirs, data_dirs) != 0
+          )
+          {
+            result = system_acquire_locked(&posix_backend, config_dirs, data_dirs);
+            if (result != 0)
+              {
+                if (env_system != 0)
+                  {
+                    system_release_locked(env_system);
+                  } /*if*/
+                env_system = result;
+              } /*if*/
+          }
+        else
+          {
+            result = env_system;
+          } /*if*/
+        if (result != 0)
+          {
+            ++result->refcount;
+          } /*if*/
+        pthread_mutex_unlock(&systems_lock);
+      } /*if*/
+    return
+        result;
+  } /*context_system*/
+
+static void context_system_release
+  (
+    const xdg_context * ctx,
+    struct xdg_system * sys
+  )
+  /* disposes of the result of context_system(ctx). */
+  {
+    if (ctx == 0)
+      {
+        system_release(sys);
+      } /*if*/
+  } /*context_system_release*/
+
+static const char * context_user_var
+  (
+    const xdg_context * ctx,
+    int var
+  )
+  /* returns the explicit setting of the specified per-user variable for ctx, or NULL
+    if the default is to be used. */
+  {
+    return
+        ctx != 0 ? ctx->user_vars[var] : getenv(user_var_names[var]);
+  } /*context_user_var*/
+
+static const char * context_home
+  (
+    const xdg_context * ctx
+  )
+  {
+    return
+        ctx != 0 ? ctx->home : getenv("HOME");
+  } /*context_home*/
+
+static uid_t context_uid
+  (
+    const xdg_context * ctx
+  )
+  {
+    return
+        ctx != 0 ? ctx->uid : geteuid();
+  } /*context_uid*/
+
+static xdg_fs_backend * context_backend
+  (
+    const xdg_context * ctx
+  )
+  {
+    return
+        ctx != 0 ? ctx->system->backend : &posix_backend;
+  } /*context_backend*/
+
+static int context_makedirsif
+  (
+    const xdg_context * ctx,
+    const char * path
+  )
+  /* makedirsif through the backend for ctx. Directories are always created by the
+    calling process, so if ctx is for some other user this fails with EPERM instead,
+    rather than leave that user with directories they do not own, unless path
+    already exists and there is nothing to create. */
+  {
+    xdg_fs_backend * const backend = context_backend(ctx);
+    struct stat statinfo;
+    int status;
+    if (context_uid(ctx) == geteuid())
+      {
+        status = makedirsif(backend, path);
+      }
+    else if (backend->stat(backend, path, &statinfo) == 0)
+      {
+        status = 0;
+      }
+    else
+      {
+        errno = EPERM;
+        status = -1;
+      } /*if*/
+    return
+        status;
+  } /*context_makedirsif*/
+
+#define LISTING_RECHECK_NS 1000000000L
+  /* how long a directory listing is trusted before the directory's modification
+    time is checked again */
+
+static int compare_hashes
+  (
+    const void * a,
+    const void * b
+  )
+  {
+    const size_t ha = *(const size_t *)a;
+    const size_t hb = *(const size_t *)b;
+    return
+        ha < hb ? -1 : ha > hb ? 1 : 0;
+  } /*compare_hashes*/
+
+static void listing_refresh
+  (
+    struct xdg_system * sys,
+    struct dir_listing * listing,
+    const char * dirpath,
+    const struct timespec * now /* monotonic */
+  )
+  /* brings listing up to date with the directory at dirpath, rereading its entries
+    only if it has been modified since they were last read. Caller must hold
+    sys->listings_lock. */
+  {
+    struct stat statinfo;
+    bool reread;
+    listing->checked = *now;
+    listing->listed = true;
+    if (sys->backend->stat(sys->backend, dirpath, &statinfo) != 0 || !S_ISDIR(statinfo.st_mode))
+      {
+        listing->state =
+            errno == EACCES || errno == ELOOP || errno == ENOMEM ?
+                LISTING_UNKNOWN
+            :
+                LISTING_ABSENT;
+        listing->racy = false;
+        reread = false;
+        free(listing->name_hashes);
+        listing->name_hashes = 0;
+        listing->nr_names = 0;
+      }
+    else
+      {
+        reread =
+                listing->state != LISTING_PRESENT
+            ||
+                listing->racy
+            ||
+                statinfo.st_mtim.tv_sec != listing->mtime.tv_sec
+            ||
+                statinfo.st_mtim.tv_nsec != listing->mtime.tv_nsec;
+      } /*if*/
+    if (reread)
+      {
+        size_t * hashes = 0;
+        size_t nr_hashes = 0;
+        size_t hashes_alloc = 0;
+        int add_name
+          (
+            const char * name,
+            void * unused
+          )
+          {
+            int status = 0;
+            if (nr_hashes == hashes_alloc)
+              {
+                const size_t new_alloc = hashes_alloc != 0 ? hashes_alloc * 2 : 64;
+                size_t * const new_hashes = realloc(hashes, new_alloc * sizeof(size_t));
+                if (new_hashes != 0)
+                  {
+                    hashes = new_hashes;
+                    hashes_alloc = new_alloc;
+                  }
+                else
+                  {
+                    status = -1;
+                  } /*if*/
+              } /*if*/
+            if (status == 0)
+              {
+                hashes[nr_hashes++] = path_hash(name, strlen(name));
+              } /*if*/
+            return
+                status;
+          } /*add_name*/;
+
+        free(listing->name_hashes);
+        if (sys->backend->readdir(sys->backend, dirpath, add_name, 0) == 0)
+          {
+            struct timespec realnow;
+            qsort(hashes, nr_hashes, sizeof(size_t), compare_hashes);
+            listing->name_hashes = hashes;
+            listing->nr_names = nr_hashes;
+            listing->mtime = statinfo.st_mtim;
+            listing->state = LISTING_PRESENT;
+            clock_gettime(CLOCK_REALTIME_COARSE, &realnow);
+            listing->racy = statinfo.st_mtim.tv_sec >= realnow.tv_sec - 1;
+              /* a further change this soon might not alter the mtime, so don't
+                trust the listing beyond this lookup */
+          }
+        else
+          {
+            free(hashes);
+            listing->name_hashes = 0;
+            listing->nr_names = 0;
+            listing->state = LISTING_UNKNOWN;
+            listing->racy = false;
+          } /*if*/
+      } /*if*/
+  } /*listing_refresh*/
+
+static bool listing_applicable
+  (
+    int dir_index, /* -1 for the user area */
+    const char * dirpath, /* not null-terminated */
+    size_t dirpath_len
+  )
+  /* is a listing kept for this search directory. */
+  {
+    return
+            dir_index >= 0
+        &&
+            dirpath_len != 0
+        &&
+            dirpath[0] == '/' /* relative ones depend on current directory */
+        &&
+            dirpath_len < PATH_MAX;
+  } /*listing_applicable*/
+
+static struct dir_listing * listing_get
+  (
+    struct xdg_system * sys,
+    bool config, /* true for config, false for data */
+    int dir_index,
+    const char * dirpath, /* not null-terminated */
+    size_t dirpath_len
+  )
+  /* returns the listing for the specified system search directory, refreshing it
+    first if it is due to be rechecked. listing_applicable must be true for the
+    directory. Caller must hold sys->listings_lock. */
+  {
+    struct dir_listing * const listing = &sys->listings[config][dir_index];
+    struct timespec now;
+    assert(dir_index < sys->nr_dirs[config]);
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    if
+      (
+            !listing->listed
+        ||
+            listing->racy
+        ||
+                (now.tv_sec - listing->checked.tv_sec) * 1000000000L
+            +
+                (now.tv_nsec - listing->checked.tv_nsec)
+            >
+                LISTING_RECHECK_NS
+      )
+      {
+        char path[PATH_MAX];
+        memcpy(path, dirpath, dirpath_len);
+        path[dirpath_len] = '\0';
+        listing_refresh(sys, listing, path, &now);
+      } /*if*/
+    return
+        listing;
+  } /*listing_get*/
+
+static bool listing_may_contain
+  (
+    struct xdg_system * sys,
+    bool config, /* true for config, false for data */
+    int dir_index, /* -1 for the user area */
+    const char * dirpath, /* not null-terminated */
+    size_t dirpath_len,
+    const char * itempath
+  )
+  /* checks the cached listing of a system search directory for the first component
+    of itempath. Returns false only if that definitely doesn't exist, so there is no
+    point looking in this directory. */
+  {
+    const int save_errno = errno;
+    const char * const compend = strchrnul(itempath, '/');
+    const size_t complen = compend - itempath;
+    bool result = true;
+    if
+      (
+            listing_applicable(dir_index, dirpath, dirpath_len)
+        &&
+            complen != 0
+        &&
+            !(complen == 1 && itempath[0] == '.')
+        &&
+            !(complen == 2 && itempath[0] == '.' && itempath[1] == '.')
+      )
+      {
+        const struct dir_listing * listing;
+        pthread_mutex_lock(&sys->listings_lock);
+        listing = listing_get(sys, config, dir_index, dirpath, dirpath_len);
+        if (listing->state == LISTING_ABSENT)
+          {
+            result = false;
+          }
+        else if (listing->state == LISTING_PRESENT)
+          {
+            const size_t hash = path_hash(itempath, complen);
+            result =
+                bsearch(&hash, listing->name_hashes, listing->nr_names, sizeof(size_t), compare_hashes) != 0;
+          } /*if*/
+        pthread_mutex_unlock(&sys->listings_lock);
+      } /*if*/
+    errno = save_errno;
+    return
+        result;
+  } /*listing_may_contain*/
+
+/*
+    Content hashing
+*/
+
+static const uint32_t sha256_k[64] =
+  {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+  };
+
+#define SHA256_ROR(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+static void sha256_block
+  (
+    uint32_t h[8],
+    const unsigned char * block /* 64 bytes */
+  )
+  /* updates the hash state h with the next block of input. */
+  {
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, hh;
+    int i;
+    for (i = 0; i < 16; ++i)
+      {
+        w[i] =
+                (uint32_t)block[i * 4] << 24
+            |
+                (uint32_t)block[i * 4 + 1] << 16
+            |
+                (uint32_t)block[i * 4 + 2] << 8
+            |
+                (uint32_t)block[i * 4 + 3];
+      } /*for*/
+    for (i = 16; i < 64; ++i)
+      {
+        const uint32_t s0 = SHA256_ROR(w[i - 15], 7) ^ SHA256_ROR(w[i - 15], 18) ^ w[i - 15] >> 3;
+        const uint32_t s1 = SHA256_ROR(w[i - 2], 17) ^ SHA256_ROR(w[i - 2], 19) ^ w[i - 2] >> 10;
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+      } /*for*/
+    a = h[0];
+    b = h[1];
+    c = h[2];
+    d = h[3];
+    e = h[4];
+    f = h[5];
+    g = h[6];
+    hh = h[7];
+    for (i = 0; i < 64; ++i)
+      {
+        const uint32_t s1 = SHA256_ROR(e, 6) ^ SHA256_ROR(e, 11) ^ SHA256_ROR(e, 25);
+        const uint32_t ch = (e & f) ^ (~e & g);
+        const uint32_t t1 = hh + s1 + ch + sha256_k[i] + w[i];
+        const uint32_t s0 = SHA256_ROR(a, 2) ^ SHA256_ROR(a, 13) ^ SHA256_ROR(a, 22);
+        const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        const uint32_t t2 = s0 + maj;
+        hh = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+      } /*for*/
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += hh;
+  } /*sha256_block*/
+
+#undef SHA256_ROR
+
+static void sha256
+  (
+    const void * data,
+    size_t data_len,
+    unsigned char digest[XDG_BLOB_DIGEST_SIZE]
+  )
+  /* computes the SHA-256 digest of the specified data. */
+  {
+    uint32_t h[8] =
+      {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+      };
+    const unsigned char * in = data;
+    const uint64_t bit_len = (uint64_t)data_len * 8;
+    unsigned char tail[128];
+    size_t tail_len;
+    int i;
+    for (; data_len >= 64; data_len -= 64, in += 64)
+      {
+        sha256_block(h, in);
+      } /*for*/
+    memcpy(tail, in, data_len);
+    tail[data_len] = 0x80;
+    tail_len = data_len + 1 + 8 <= 64 ? 64 : 128;
+    memset(tail + data_len + 1, 0, tail_len - data_len - 1);
+    for (i = 0; i < 8; ++i)
+      {
+        tail[tail_len - 1 - i] = bit_len >> i * 8;
+      } /*for*/
+    sha256_block(h, tail);
+    if (tail_len > 64)
+      {
+        sha256_block(h, tail + 64);
+      } /*if*/
+    for (i = 0; i < 8; ++i)
+      {
+        digest[i * 4] = h[i] >> 24;
+        digest[i * 4 + 1] = h[i] >> 16;
+        digest[i * 4 + 2] = h[i] >> 8;
+        digest[i * 4 + 3] = h[i];
+      } /*for*/
+  } /*sha256*/
+
+/*
+    User-visible stuff
+*/
+
+int xdg_makedirsif
+  (
+    const char * path
+  )
+  /* creates all the directories in path, if they don't already exist. Returns
+    nonzero and sets errno on error. */
+  {
+    return
+        makedirsif(&posix_backend, path);
+  } /*xdg_makedirsif*/
+
+xdg_fs_backend * xdg_posix_backend(void)
+  /* returns the backend that operates directly on the live filesystem. This is
+    what is used unless another one is specified; it need not be disposed. */
+  {
+    return
+        &posix_backend;
+  } /*xdg_posix_backend*/
+
+xdg_fs_backend * xdg_sysroot_backend_new
+  (
+    const char * sysroot
+  )
+  /* returns a backend that operates on the live filesystem, but with all paths
+    resolved within the directory sysroot, e.g. an unpacked container image, as
+    though the process had been chrooted there: ".." components and symlinks,
+    including absolute ones, cannot lead outside it. This relies on openat2(2),
+    available from Linux 5.6; fails with ENOSYS if it's not. Returns NULL and sets
+    errno on error. Dispose of the result with xdg_fs_backend_dispose. */
+  {
+    struct sysroot_backend * result = malloc(sizeof(struct sysroot_backend));
+    do /*once*/
+      {
+        if (result == 0)
+            break;
+        result->base.stat = sysroot_stat;
+        result->base.open = sysroot_open;
+        result->base.mkdir = sysroot_mkdir;
+        result->base.readdir = sysroot_readdir;
+        result->base.rename = sysroot_rename;
+        result->base.unlink = sysroot_unlink;
+        result->base.dispose = sysroot_dispose;
+        result->root_fd = open(sysroot, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (result->root_fd < 0)
+          {
+            free(result);
+            result = 0;
+            break;
+          } /*if*/
+          {
+          /* check openat2 is usable now rather than failing every lookup later */
+            const int fd = sysroot_openat(result, "/", O_PATH | O_CLOEXEC, 0);
+            if (fd < 0)
+              {
+                close_keep_errno(result->root_fd);
+                free(result);
+                result = 0;
+                break;
+              } /*if*/
+            close(fd);
+          }
+      }
+    while (false);
+    return
+        result != 0 ? &result->base : 0;
+  } /*xdg_sysroot_backend_new*/
+
+xdg_fs_backend * xdg_memfs_backend_new(void)
+  /* returns a backend that operates on a tree held entirely in memory, initially
+    containing only an empty root directory. Populate it with xdg_memfs_add or
+    xdg_memfs_load_manifest, or via its mkdir and open (with O_CREAT) operations.
+    Files have a size but no contents: opening one returns an anonymous file of that
+    size reading as all zeroes. All operations are safe to use from multiple
+    threads. Returns NULL and sets errno on error. Dispose of the result with
+    xdg_fs_backend_dispose. */
+  {
+    struct memfs_backend * result = malloc(sizeof(struct memfs_backend));
+    do /*once*/
+      {
+        if (result == 0)
+            break;
+        result->base.stat = memfs_stat;
+        result->base.open = memfs_open;
+        result->base.mkdir = memfs_mkdir;
+        result->base.readdir = memfs_readdir;
+        result->base.rename = memfs_rename;
+        result->base.unlink = memfs_unlink;
+        result->base.dispose = memfs_dispose;
+        pthread_mutex_init(&result->lock, 0);
+        result->nr_buckets = 64;
+        result->nr_nodes = 0;
+        result->next_ino = 0;
+        result->buckets = calloc(result->nr_buckets, sizeof(struct memfs_node *));
+        if (result->buckets == 0 || memfs_create(result, "/", 1, S_IFDIR | 0755, 0) == 0)
+          {
+            memfs_dispose(&result->base);
+            result = 0;
+            errno = ENOMEM;
+            break;
+          } /*if*/
+      }
+    while (false);
+    return
+        result != 0 ? &result->base : 0;
+  } /*xdg_memfs_backend_new*/
+
+int xdg_memfs_add
+  (
+    xdg_fs_backend * memfs,
+    const char * path,
+    mode_t type, /* S_IFDIR or S_IFREG */
+    off_t size /* ignored for directories */
+  )
+  /* adds an entry to a backend created by xdg_memfs_backend_new, creating any
+    missing parent directories. If the entry already exists with the same type,
+    its size is updated. Returns nonzero and sets errno on error. */
+  {
+    struct memfs_backend * const self = (struct memfs_backend *)memfs;
+    char normpath[PATH_MAX];
+    size_t normpath_len;
+    int status = -1;
+    do /*once*/
+      {
+        size_t seg_end;
+        if (memfs->stat != memfs_stat || (type != S_IFDIR && type != S_IFREG))
+          {
+            errno = EINVAL;
+            break;
+          } /*if*/
+        if (memfs_normalize(path, normpath, &normpath_len) != 0)
+            break;
+        pthread_mutex_lock(&self->lock);
+        seg_end = 1;
+        for (;;)
+          {
+            struct memfs_node * node;
+            const bool last = seg_end >= normpath_len;
+            const char save_ch = normpath[seg_end];
+            const size_t this_len = last ? normpath_len : seg_end;
+            normpath[this_len] = '\0';
+            node = memfs_lookup(self, normpath, this_len);
+            if (node == 0)
+              {
+                node = memfs_create
+                  (
+                    /*memfs =*/ self,
+                    /*path =*/ normpath,
+                    /*path_len =*/ this_len,
+                    /*mode =*/ last ? type | (type == S_IFDIR ? 0755 : 0644) : S_IFDIR | 0755,
+                    /*size =*/ last && type == S_IFREG ? size : 0
+                  );
+                if (node == 0)
+                    break;
+              }
+            else if ((node->mode & S_IFMT) != (last ? type : S_IFDIR))
+              {
+                errno = last ? EEXIST : ENOTDIR;
+                break;
+              }
+            else if (last && type == S_IFREG)
+              {
+                node->size = size;
+              } /*if*/
+            if (last)
+              {
+                status = 0;
+                break;
+              } /*if*/
+            normpath[seg_end] = save_ch;
+            seg_end = strchrnul(normpath + seg_end + 1, '/') - normpath;
+          } /*for*/
+        pthread_mutex_unlock(&self->lock);
+      }
+    while (false);
+    return
+        status;
+  } /*xdg_memfs_add*/
+
+int xdg_memfs_load_manifest
+  (
+    xdg_fs_backend * memfs,
+    const char * manifest_path
+  )
+  /* adds the entries listed in the specified manifest file to a backend created by
+    xdg_memfs_backend_new. Each line of the manifest has the form
+
+        type size path
+
+    where type is "d" for a directory or a single letter for any other kind of
+    entry (which is added as a regular file), size is a decimal byte count and path
+    is relative to the root of the tree. Blank lines and lines beginning with "#"
+    are ignored. This is the format produced by
+
+        find . -printf '%y %s %P\n'
+
+    run at the top of an unpacked image. Returns nonzero and sets errno on error
+    (EINVAL for a malformed line), in which case entries from preceding lines will
+    still have been added. */
+  {
+    FILE * const manifest = fopen(manifest_path, "re");
+    char * line = 0;
+    size_t line_size = 0;
+    int status = -1;
+    if (manifest != 0)
+      {
+        for (;;)
+          {
+            ssize_t line_len;
+            char type;
+            char * rest;
+            unsigned long long size;
+            errno = 0;
+            line_len = getline(&line, &line_size, manifest);
+            if (line_len < 0)
+              {
+                status = errno != 0 ? -1 : 0;
+                break;
+              } /*if*/
+            if (line_len != 0 && line[line_len - 1] == '\n')
+              {
+                line[--line_len] = '\0';
+              } /*if*/
+            if (line_len == 0 || line[0] == '#')
+                continue;
+            type = line[0];
+            if (line_len < 2 || line[1] != ' ')
+              {
+                errno = EINVAL;
+                break;
+              } /*if*/
+            errno = 0;
+            size = strtoull(line + 2, &rest, 10);
+            if (errno != 0 || rest == line + 2 || (*rest != ' ' && *rest != '\0'))
+              {
+                errno = EINVAL;
+                break;
+              } /*if*/
+            if (*rest == ' ')
+              {
+                ++rest;
+              } /*if*/
+            if
+              (
+                xdg_memfs_add
+                  (
+                    /*memfs =*/ memfs,
+                    /*path =*/ rest,
+                    /*type =*/ type == 'd' ? S_IFDIR : S_IFREG,
+                    /*size =*/ (off_t)size
+                  )
+                !=
+                    0
+              )
+                break;
+          } /*for*/
+        free(line);
+          {
+            const int save_errno = errno;
+            fclose(manifest);
+            errno = save_errno;
+          }
+      } /*if*/
+    return
+        status;
+  } /*xdg_memfs_load_manifest*/
+
+void xdg_fs_backend_dispose
+  (
+    xdg_fs_backend * backend
+  )
+  /* disposes of a backend created by xdg_sysroot_backend_new or
+    xdg_memfs_backend_new, or any other one that has a dispose operation. Does
+    nothing if backend is NULL. It must no longer be in use by any context. */
+  {
+    if (backend != 0 && backend->dispose != 0)
+      {
+        backend->dispose(backend);
+      } /*if*/
+  } /*xdg_fs_backend_dispose*/
+
+xdg_context * xdg_context_new
+  (
+    const char * home,
+    uid_t uid,
+    const char * const * vars
+  )
+  /* creates a resolution context for the user with the specified home directory and
+    user ID. vars is NULL or a NULL-terminated array of "NAME=value" strings in the
+    manner of environ: any XDG_CONFIG_HOME, XDG_DATA_HOME, XDG_CACHE_HOME or
+    XDG_RUNTIME_DIR entries in it override the defaults derived from home and uid, and
+    any XDG_CONFIG_DIRS or XDG_DATA_DIRS entries override the system search paths,
+    which otherwise come from the process environment. Other entries are ignored.
+    Returns NULL and sets errno on error. Dispose of the result with
+    xdg_context_dispose. */
+  {
+    const char * settings[XDG_NR_USER_VARS] = {0};
+    const char * config_dirs = 0;
+    const char * data_dirs = 0;
+    xdg_context * result = 0;
+    do /*once*/
+      {
+        size_t strings_len;
+        char * nextstr;
+        int i;
+        if (home == 0 || home[0] != '/')
+          {
+            errno = EINVAL;
+            break;
+          } /*if*/
+        if (vars != 0)
+          {
+            const char * const * var;
+            for (var = vars; *var != 0; ++var)
+              {
+                const char * const sep = strchr(*var, '=');
+                const char ** setting = 0;
+                if (sep == 0)
+                    continue;
+                for (i = 0; i < XDG_NR_USER_VARS; ++i)
+                  {
+                    if
+                      (
+                            strlen(user_var_names[i]) == sep - *var
+                        &&
+                            memcmp(*var, user_var_names[i], sep - *var) == 0
+                      )
+                      {
+                        setting = &settings[i];
+                        break;
+                      } /*if*/
+                  } /*for*/
+                if (setting == 0)
+                  {
+                    if (sep - *var == 15 && memcmp(*var, "XDG_CONFIG_DIRS", 15) == 0)
+                      {
+                        setting = &config_dirs;
+                      }
+                    else if (sep - *var == 13 && memcmp(*var, "XDG_DATA_DIRS", 13) == 0)
+                      {
+                        setting = &data_dirs;
+                      } /*if*/
+                  } /*if*/
+                if (setting != 0 && *setting == 0)
+                  {
+                    *setting = sep + 1; /* first occurrence wins, as with getenv */
+                  } /*if*/
+              } /*for*/
+          } /*if*/
+        if (config_dirs == 0)
+          {
+            config_dirs = getenv("XDG_CONFIG_DIRS");
+            if (config_dirs == 0)
+              {
+                config_dirs = DEFAULT_CONFIG_DIRS;
+              } /*if*/
+          } /*if*/
+        if (data_dirs == 0)
+          {
+            data_dirs = getenv("XDG_DATA_DIRS");
+            if (data_dirs == 0)
+              {
+                data_dirs = DEFAULT_DATA_DIRS;
+              } /*if*/
+          } /*if*/
+        strings_len = strlen(home) + 1;
+        for (i = 0; i < XDG_NR_USER_VARS; ++i)
+          {
+            if (settings[i] != 0)
+              {
+                strings_len += strlen(settings[i]) + 1;
+              } /*if*/
+          } /*for*/
+        result = malloc(sizeof(xdg_context) + strings_len);
+        if (result == 0)
+            break;
+        nextstr = result->strings;
+        strcpy(nextstr, home);
+        result->home = nextstr;
+        nextstr += strlen(nextstr) + 1;
+        for (i = 0; i < XDG_NR_USER_VARS; ++i)
+          {
+            if (settings[i] != 0)
+              {
+                strcpy(nextstr, settings[i]);
+                result->user_vars[i] = nextstr;
+                nextstr += strlen(nextstr) + 1;
+              }
+            else
+              {
+                result->user_vars[i] = 0;
+              } /*if*/
+          } /*for*/
+        result->uid = uid;
+        pthread_mutex_lock(&systems_lock);
+        result->system = system_acquire_locked(&posix_backend, config_dirs, data_dirs);
+        pthread_mutex_unlock(&systems_lock);
+        if (result->system == 0)
+          {
+            free(result);
+            result = 0;
+            errno = ENOMEM;
+            break;
+          } /*if*/
+      }
+    while (false);
+    return
+        result;
+  } /*xdg_context_new*/
+
+xdg_context * xdg_context_new_for_user
+  (
+    const char * username
+  )
+  /* creates a resolution context for the named user, taking the home directory and
+    user ID from the password database, with no explicit per-user settings. Returns
+    NULL and sets errno on error (ENOENT if there is no such user). Dispose of the
+    result with xdg_context_dispose. */
+  {
+    xdg_context * result = 0;
+    long bufsize = sysconf(_SC_GETPW_R_SIZE_MAX);
+    char * buf = 0;
+    if (bufsize <= 0)
+      {
+        bufsize = 1024;
+      } /*if*/
+    for (;;)
+      {
+        struct passwd pwd;
+        struct passwd * found;
+        int status;
+        char * const newbuf = realloc(buf, bufsize);
+        if (newbuf == 0)
+            break;
+        buf = newbuf;
+        status = getpwnam_r(username, &pwd, buf, bufsize, &found);
+        if (status == ERANGE)
+          {
+            bufsize *= 2;
+            continue;
+          } /*if*/
+        if (status != 0)
+          {
+            errno = status;
+            break;
+          } /*if*/
+        if (found == 0)
+          {
+            errno = ENOENT;
+            break;
+          } /*if*/
+        result = xdg_context_new(pwd.pw_dir, pwd.pw_uid, 0);
+        break;
+      } /*for*/
+    free(buf);
+    return
+        result;
+  } /*xdg_context_new_for_user*/
+
+void xdg_context_dispose
+  (
+    xdg_context * ctx
+  )
+  /* disposes of a context created by xdg_context_new or xdg_context_new_for_user.
+    Does nothing if ctx is NULL. */
+  {
+    if (ctx != 0)
+      {
+        system_release(ctx->system);
+        free(ctx);
+      } /*if*/
+  } /*xdg_context_dispose*/
+
+int xdg_context_set_backend
+  (
+    xdg_context * ctx,
+    xdg_fs_backend * backend
+  )
+  /* makes all config, data and cache lookups for ctx go through the specified
+    filesystem backend, which must remain valid for as long as ctx uses it. This
+    must be done before ctx is shared between threads. Runtime-directory routines
+    always use the live filesystem. Returns nonzero and sets errno on error. */
+  {
+    struct xdg_system * new_system;
+    int status = -1;
+    pthread_mutex_lock(&systems_lock);
+    new_system = system_acquire_locked(backend, ctx->system->config_dirs, ctx->system->data_dirs);
+    if (new_system != 0)
+      {
+        system_release_locked(ctx->system);
+        ctx->system = new_system;
+        status = 0;
+      }
+    else
+      {
+        errno = ENOMEM;
+      } /*if*/
+    pthread_mutex_unlock(&systems_lock);
+    return
+        status;
+  } /*xdg_context_set_backend*/
+
+char * xdg_context_make_home_relative
+  (
+    const xdg_context * ctx,
+    const char * path
+  )
+  /* prepends the home directory for ctx onto path (assumed not to begin with a
+    slash), or NULL on error (out of memory, home not defined or not absolute).
+    Caller must dispose of the result pointer. */
+  {
+    const char * const home = context_home(ctx);
+    char * result = 0;
+    size_t result_len;
+    do /*once*/
+      {
+        if (home == 0 || home[0] != '/')
+          {
+            errno = ENOENT;
+            break;
+          } /*if*/
+      /* assert strlen(home) > 0 */
+        result_len = strlen(home) + 1 + strlen(path) + 1; /* worst case */
+        result = malloc(result_len);
+        if (result == 0)
+            break;
+        strncpy(result, home, result_len);
+        if (result[strlen(result) - 1] != '/')
+          {
+            strconcat(result, result_len, "/");
+          } /*if*/
+        strconcat(result, result_len, path);
+      }
+    while (false);
+    return
+        result;
+  } /*xdg_context_make_home_relative*/
+
+char * xdg_make_home_relative
+  (
+    const char * path
+  )
+  /* prepends the value of $HOME onto path (assumed not to begin with a slash), or
+    NULL on error (out of memory, $HOME not defined or not absolute). Caller must dispose
+    of the result pointer. */
+  {
+    return
+        xdg_context_make_home_relative(0, path);
+  } /*xdg_make_home_relative*/
+
+static char * get_user_dir
+  (
+    const xdg_context * ctx,
+    int var, /* which per-user variable */
+    const char * home_relative, /* default location relative to home */
+    bool makedirs
+  )
+  /* common internal routine for xdg_context_get_config_home, xdg_context_get_data_home
+    and xdg_context_get_cache_home. */
+  {
+    const char * const setting = context_user_var(ctx, var);
+    char * result;
+    if (setting != 0)
+      {
+        result = strdup(setting);
+      }
+    else
+      {
+        result = xdg_context_make_home_relative(ctx, home_relative);
+      } /*if*/
+    if (result != 0 && makedirs && context_makedirsif(ctx, result) != 0)
+      {
+        free(result);
+        result = 0;
+      } /*if*/
+    return
+        result;
+  } /*get_user_dir*/
+
+char * xdg_context_get_config_home
+  (
+    const xdg_context * ctx,
+    bool makedirs
+  )
+  /* returns the directory for holding user-specific config files for ctx, or NULL on
+    error. Caller must dispose of the result pointer. */
+  {
+    return
+        get_user_dir(ctx, XDG_VAR_CONFIG_HOME, ".config", makedirs);
+  } /*xdg_context_get_config_home*/
+
+char * xdg_get_config_home
+  (
+    bool makedirs
+  )
+  /* returns the directory for holding user-specific config files, or NULL on
+    error. Caller must dispose of the result pointer. */
+  {
+    return
+        xdg_context_get_config_home(0, makedirs);
+  } /*xdg_get_config_home*/
+
+char * xdg_context_get_data_home
+  (
+    const xdg_context * ctx,
+    bool makedirs
+  )
+  /* returns the directory for holding user-specific data files for ctx, or NULL on
+    error. Caller must dispose of the result pointer. */
+  {
+    return
+        get_user_dir(ctx, XDG_VAR_DATA_HOME, ".local/share", makedirs);
+  } /*xdg_context_get_data_home*/
+
+char * xdg_get_data_home
+  (
+    bool makedirs
+  )
+  /* returns the directory for holding user-specific data files, or NULL on
+    error. Caller must dispose of the result pointer. */
+  {
+    return
+        xdg_context_get_data_home(0, makedirs);
+  } /*xdg_get_data_home*/
+
+char * xdg_context_get_cache_home
+  (
+    const xdg_context * ctx,
+    bool makedirs
+  )
+  /* returns the directory for holding user-specific cache files for ctx, or NULL on
+    error. Caller must dispose of the result pointer. */
+  {
+    return
+        get_user_dir(ctx, XDG_VAR_CACHE_HOME, ".cache", makedirs);
+  } /*xdg_context_get_cache_home*/
+
+char * xdg_get_cache_home
+  (
+    bool makedirs
+  )
+  /* returns the directory for holding user-specific cache files, or NULL on
+    error. Caller must dispose of the result pointer. */
+  {
+    return
+        xdg_context_get_cache_home(0, makedirs);
+  } /*xdg_get_cache_home*/
+
+char * xdg_context_get_runtime_dir
+  (
+    const xdg_context * ctx,
+    bool makedirs
+  )
+  /* returns the directory for holding user-specific runtime files for ctx, as for
+    xdg_get_runtime_dir but using the explicit XDG_RUNTIME_DIR setting and user ID
+    of ctx. If ctx is for some other user, the fallback directory is never created,
+    and makedirs fails with EPERM if it does not already exist. Caller must dispose
+    of the result pointer. */
+  {
+    const uid_t uid = context_uid(ctx);
+    char * result = 0;
+    do /*once*/
+      {
+        const char * const setting = context_user_var(ctx, XDG_VAR_RUNTIME_DIR);
+        char fallback[64];
+        if (setting != 0 && check_runtime_dir(setting, uid) == 0)
+          {
+            result = strdup(setting);
+            break;
+          } /*if*/
+        snprintf(fallback, sizeof fallback, "/run/user/%u", (unsigned int)uid);
+        if (check_runtime_dir(fallback, uid) == 0)
+          {
+            result = strdup(fallback);
+            break;
+          } /*if*/
+          {
+            const char * tmpdir = getenv("TMPDIR");
+            if (tmpdir == 0 || tmpdir[0] != '/')
+              {
+                tmpdir = "/tmp";
+              } /*if*/
+            snprintf(fallback, sizeof fallback, "xdg-runtime-%u", (unsigned int)uid);
+            result = path_join(tmpdir, fallback);
+          }
+        if (result == 0)
+            break;
+        if
+          (
+                makedirs
+            &&
+                uid == geteuid() /* not ours to create for anybody else */
+            &&
+                mkdir(result, 0700) != 0
+            &&
+                errno != EEXIST
+          )
+          {
+            free(result);
+            result = 0;
+            break;
+          } /*if*/
+        if (check_runtime_dir(result, uid) != 0)
+          {
+            if (makedirs && errno == ENOENT)
+              {
+                errno = EPERM;
+              } /*if*/
+            free(result);
+            result = 0;
+          } /*if*/
+      }
+    while (false);
+    return
+        result;
+  } /*xdg_context_get_runtime_dir*/
+
+char * xdg_get_runtime_dir
+  (
+    bool makedirs
+  )
+  /* returns the directory for holding user-specific runtime files (sockets, locks,
+    shared memory and the like), or NULL on error. This is $XDG_RUNTIME_DIR if that
+    passes the ownership and permission checks required by the spec, otherwise
+    /run/user/<uid> if that passes the same checks. Failing both, the fallback is a
+    private directory xdg-runtime-<uid> under $TMPDIR (or /tmp), created if makedirs,
+    and used if it passes the checks; note this may not be on tmpfs, and will not be
+    cleaned up at logout. Caller must dispose of the result pointer. */
+  {
+    return
+        xdg_context_get_runtime_dir(0, makedirs);
+  } /*xdg_get_runtime_dir*/
+
+int xdg_runtime_socket
+  (
+    const char * itempath,
+    int type
+  )
+  /* creates a UNIX-domain socket of the specified type (SOCK_STREAM, SOCK_DGRAM or
+    SOCK_SEQPACKET) bound to itempath within the runtime directory, and puts it into
+    the listening state if the type is connection-oriented. A socket file left over
+    from a process that is no longer listening is replaced; one that is still live, or
+    anything at itempath that is not a socket, is not, and the call fails with errno
+    set to EADDRINUSE. Returns the socket fd, or -1 and sets errno on error. */
+  {
+    struct sockaddr_un addr;
+    int fd = -1;
+    do /*once*/
+      {
+        if (runtime_socket_addr(&addr, itempath, true) != 0)
+            break;
+        fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            break;
+        if (bind(fd, (const struct sockaddr *)&addr, sizeof addr) != 0)
+          {
+            bool stale;
+            if (errno != EADDRINUSE)
+              {
+                close_keep_errno(fd);
+                fd = -1;
+                break;
+              } /*if*/
+              {
+                struct stat statinfo;
+                int probe = -1;
+                /* only ever replace a socket, never some other file that happens to
+                  be in the way. The probe is nonblocking so a live listener with a
+                  full backlog (EAGAIN) cannot hang it; only ECONNREFUSED means nobody
+                  is listening. */
+                stale =
+                        lstat(addr.sun_path, &statinfo) == 0
+                    &&
+                        S_ISSOCK(statinfo.st_mode)
+                    &&
+                        (probe = socket(AF_UNIX, type | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) >= 0
+                    &&
+                        connect(probe, (const struct sockaddr *)&addr, sizeof addr) != 0
+                    &&
+                        errno == ECONNREFUSED;
+                if (probe >= 0)
+                  {
+                    close(probe);
+                  } /*if*/
+              }
+            if (!stale)
+              {
+                close(fd);
+                fd = -1;
+                errno = EADDRINUSE;
+                break;
+              } /*if*/
+            if
+              (
+                    unlink(addr.sun_path) != 0
+                ||
+                    bind(fd, (const struct sockaddr *)&addr, sizeof addr) != 0
+              )
+              {
+                close_keep_errno(fd);
+                fd = -1;
+                break;
+              } /*if*/
+          } /*if*/
+        if (type != SOCK_DGRAM && listen(fd, SOMAXCONN) != 0)
+          {
+            close_keep_errno(fd);
+            fd = -1;
+            break;
+          } /*if*/
+      }
+    while (false);
+    return
+        fd;
+  } /*xdg_runtime_socket*/
+
+int xdg_runtime_connect
+  (
+    const char * itempath,
+    int type
+  )
+  /* returns a UNIX-domain socket of the specified type connected to the socket at
+    itempath within the runtime directory, or -1 and sets errno on error. */
+  {
+    struct sockaddr_un addr;
+    int fd = -1;
+    do /*once*/
+      {
+        if (runtime_socket_addr(&addr, itempath, false) != 0)
+            break;
+        fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            break;
+        if (connect(fd, (const struct sockaddr *)&addr, sizeof addr) != 0)
+          {
+            close_keep_errno(fd);
+            fd = -1;
+            break;
+          } /*if*/
+      }
+    while (false);
+    return
+        fd;
+  } /*xdg_runtime_connect*/
+
+int xdg_runtime_lock
+  (
+    const char * itempath,
+    bool wait
+  )
+  /* opens (creating if necessary) the file itempath within the runtime directory and
+    takes an exclusive flock(2) on it. If wait, blocks until the lock is free, otherwise
+    fails with errno set to EWOULDBLOCK if another process holds it. On success the
+    PID of the calling process is written into the file, so it can double as a
+    pidfile; the lock is held for as long as the returned fd (or any dup of it) stays
+    open. Returns -1 and sets errno on error. */
+  {
+    char * const path = runtime_item_path(itempath, true);
+    int fd = -1;
+    do /*once*/
+      {
+        char pidstr[24];
+        int pidlen;
+        if (path == 0)
+            break;
+        fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+        if (fd < 0)
+            break;
+        if (flock(fd, LOCK_EX | (wait ? 0 : LOCK_NB)) != 0)
+          {
+            close_keep_errno(fd);
+            fd = -1;
+            break;
+          } /*if*/
+        pidlen = snprintf(pidstr, sizeof pidstr, "%ld\n", (long)getpid());
+        if
+          (
+                ftruncate(fd, 0) != 0
+            ||
+                pwrite(fd, pidstr, pidlen, 0) != pidlen
+          )
+          {
+            close_keep_errno(fd);
+            fd = -1;
+            break;
+          } /*if*/
+      }
+    while (false);
+    free(path);
+    return
+        fd;
+  } /*xdg_runtime_lock*/
+
+int xdg_runtime_shm
+  (
+    const char * itempath,
+    size_t size
+  )
+  /* returns an fd for a memory-backed file of at least size bytes, suitable for
+    mmap(2). If itempath is NULL the file is anonymous (from memfd_create(2), with
+    sealing allowed); otherwise it is the named file within the runtime directory,
+    created with mode 0600 if it doesn't exist, and extended to size if shorter.
+    Returns -1 and sets errno on error. */
+  {
+    int fd = -1;
+    char * path = 0;
+    do /*once*/
+      {
+        struct stat statinfo;
+        if (itempath == 0)
+          {
+            fd = memfd_create("xdg-runtime-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+          }
+        else
+          {
+            path = runtime_item_path(itempath, true);
+            if (path == 0)
+                break;
+            fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+          } /*if*/
+        if (fd < 0)
+            break;
+        if
+          (
+                fstat(fd, &statinfo) != 0
+            ||
+                ((size_t)statinfo.st_size < size && ftruncate(fd, size) != 0)
+          )
+          {
+            close_keep_errno(fd);
+            fd = -1;
+            break;
+          } /*if*/
+      }
+    while (false);
+    free(path);
+    return
+        fd;
+  } /*xdg_runtime_shm*/
+
+static char * search_path
+  (
+    const xdg_context * ctx,
+    bool config /* true for config, false for data */
+  )
+  /* common internal routine for xdg_context_config_search_path and
+    xdg_context_data_search_path. */
+  {
+    struct xdg_system * const sys = context_system(ctx);
+    char * result = 0;
+    if (sys != 0)
+      {
+        result = strdup(config ? sys->config_dirs : sys->data_dirs);
+        context_system_release(ctx, sys);
+      }
+    else
+      {
+        errno = ENOMEM;
+      } /*if*/
+    return
+        result;
+  } /*search_path*/
+
+char * xdg_context_config_search_path
+  (
+    const xdg_context * ctx
+  )
+  /* returns a string containing the colon-separated list of config directories to
+    search for ctx (apart from the user area). Caller must dispose of the result pointer. */
+  {
+    return
+        search_path(ctx, true);
+  } /*xdg_context_config_search_path*/
+
+char * xdg_config_search_path(void)
+  /* returns a string containing the colon-separated list of config directories to search
+    (apart from the user area). Caller must dispose of the result pointer. */
+  {
+    return
+        xdg_context_config_search_path(0);
+  } /*xdg_config_search_path*/
+
+char * xdg_context_data_search_path
+  (
+    const xdg_context * ctx
+  )
+  /* returns a string containing the colon-separated list of data directories to
+    search for ctx (apart from the user area). Caller must dispose of the result pointer. */
+  {
+    return
+        search_path(ctx, false);
+  } /*xdg_context_data_search_path*/
+
+char * xdg_data_search_path(void)
+  /* returns a string containing the colon-separated list of data directories to search
+    (apart from the user area). Caller must dispose of the result pointer. */
+  {
+    return
+        xdg_context_data_search_path(0);
+  } /*xdg_data_search_path*/
+
+int xdg_for_each_path_component
+  (
+    const unsigned char * path,
+    size_t path_len,
+    xdg_path_component_action action,
+    void * actionarg,
+    bool forwards /* false to do in reverse */
+  )
+  /* splits the string path with len path_len at any colon separators, calling
+    action for each component found, in forward or reverse order as specified.
+    Returns nonzero on error, or if action returned nonzero. */
+  {
+    int status;
+    const unsigned char * const path_end = path + path_len;
+    const unsigned char * path_prev;
+    const unsigned char * path_next;
+    if (forwards)
+      {
+        path_prev = path;
+        for (;;)
+          {
+            path_next = path_prev;
+            for (;;)
+              {
+                if (path_next == path_end)
+                    break;
+                if (*path_next == ':')
+                    break;
+                ++path_next;
+              } /*for*/
+            status = action(path_prev, path_next - path_prev, actionarg);
+            if (status != 0)
+                break;
+            if (path_next == path_end)
+                break;
+            path_prev = path_next + 1;
+          } /*for*/
+      }
+    else /* backwards */
+      {
+        path_next = path_end;
+        for (;;)
+          {
+            path_prev = path_next;
+            for (;;)
+              {
+                if (path_prev == path)
+                    break;
+                --path_prev;
+                if (*path_prev == ':')
+                  {
+                    ++path_prev;
+                    break;
+                  } /*if*/
+              } /*for*/
+            status = action(path_prev, path_next - path_prev, actionarg);
+            if (status != 0)
+                break;
+            if (path_prev == path)
+                break;
+            path_next = path_prev - 1;
+          } /*for*/
+      } /*if*/
+    return status;
+  } /*xdg_for_each_path_component*/
+
+#define CONTEXT_SNAPSHOT_MAGIC "XDGCTX02"
+#define CONTEXT_SNAPSHOT_SEALS (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+#define CONTEXT_SNAPSHOT_LIFETIME_NS 5000000000L
+  /* how long after export a snapshot may be consulted, meant to cover the startup
+    of helper processes and no more */
+
+struct snapshot_header
+  /* start of a context snapshot as passed to child processes. All offsets are from
+    the start of the header, and all strings are null-terminated. */
+  {
+    char magic[8]; /* CONTEXT_SNAPSHOT_MAGIC */
+    uint64_t size; /* total bytes including header */
+    uint32_t uid;
+    int64_t created_sec, created_nsec; /* CLOCK_MONOTONIC time of export */
+    uint32_t config_home, data_home; /* string offsets, 0 if not defined */
+    uint32_t config_dirs, data_dirs; /* string offsets */
+    uint32_t nr_dirs, dirs; /* count and offset of struct snapshot_dir array */
+    uint32_t nr_items, items; /* count and offset of struct snapshot_item array */
+  };
+
+struct snapshot_dir
+  /* what the exporting process knew about one search directory. */
+  {
+    int32_t dir_index; /* position in system search path, -1 for the user area */
+    uint8_t config; /* true for config, false for data */
+    uint8_t state; /* LISTING_xxx */
+    uint8_t racy;
+    uint32_t path; /* string offset */
+    uint32_t nr_names, names; /* count and offset of sorted array of size_t hashes */
+    int64_t mtime_sec, mtime_nsec;
+  };
+
+struct snapshot_item
+  /* where the exporting process found an item with a first-path lookup. Items that
+    were not found are not recorded, since there is no cheaper way to check that they
+    are still absent than searching again. */
+  {
+    uint8_t config; /* true for config, false for data */
+    uint32_t itempath; /* string offset */
+    uint32_t found; /* string offset */
+  };
+
+static pthread_once_t snapshot_once = PTHREAD_ONCE_INIT;
+static const struct snapshot_header * snapshot;
+  /* inherited from parent process, NULL if none or not usable */
+static struct xdg_system * snapshot_system;
+  /* system state for the default context the snapshot applies to */
+static bool snapshot_stale = false;
+  /* set (atomically) once the snapshot is known to be out of date or has expired */
+
+static bool snapshot_expired
+  (
+    const struct snapshot_header * snap
+  )
+  /* has the snapshot outlived CONTEXT_SNAPSHOT_LIFETIME_NS. */
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return
+            (now.tv_sec - snap->created_sec) * 1000000000L + (now.tv_nsec - snap->created_nsec)
+        >
+            CONTEXT_SNAPSHOT_LIFETIME_NS;
+  } /*snapshot_expired*/
+
+static bool snapshot_string_ok
+  (
+    const struct snapshot_header * snap,
+    size_t size,
+    uint32_t offset,
+    bool optional /* whether 0 is allowed */
+  )
+  {
+    return
+        offset == 0 ?
+            optional
+        :
+                offset >= sizeof(struct snapshot_header)
+            &&
+                offset < size
+            &&
+                memchr((const char *)snap + offset, '\0', size - offset) != 0;
+  } /*snapshot_string_ok*/
+
+static bool snapshot_array_ok
+  (
+    size_t size,
+    uint32_t offset,
+    uint32_t count,
+    size_t elt_size
+  )
+  {
+    return
+            count == 0
+        ||
+            (
+                offset % 8 == 0
+            &&
+                offset >= sizeof(struct snapshot_header)
+            &&
+                offset <= size
+            &&
+                count <= (size - offset) / elt_size
+            );
+  } /*snapshot_array_ok*/
+
+static bool snapshot_valid
+  (
+    const struct snapshot_header * snap,
+    size_t size
+  )
+  /* checks that everything in the snapshot lies within its bounds, so it can
+    subsequently be used without further checks. */
+  {
+    const char * const base = (const char *)snap;
+    const struct snapshot_dir * dirs;
+    const struct snapshot_item * items;
+    uint32_t i;
+    bool ok =
+            memcmp(snap->magic, CONTEXT_SNAPSHOT_MAGIC, sizeof snap->magic) == 0
+        &&
+            snap->size == size
+        &&
+            snapshot_string_ok(snap, size, snap->config_home, true)
+        &&
+            snapshot_string_ok(snap, size, snap->data_home, true)
+        &&
+            snapshot_string_ok(snap, size, snap->config_dirs, false)
+        &&
+            snapshot_string_ok(snap, size, snap->data_dirs, false)
+        &&
+            snapshot_array_ok(size, snap->dirs, snap->nr_dirs, sizeof(struct snapshot_dir))
+        &&
+            snapshot_array_ok(size, snap->items, snap->nr_items, sizeof(struct snapshot_item));
+    if (ok)
+      {
+        dirs = (const struct snapshot_dir *)(base + snap->dirs);
+        for (i = 0; ok && i < snap->nr_dirs; ++i)
+          {
+            ok =
+                    dirs[i].dir_index >= -1
+                &&
+                    dirs[i].config <= 1
+                &&
+                    dirs[i].state <= LISTING_PRESENT
+                &&
+                    snapshot_string_ok(snap, size, dirs[i].path, false)
+                &&
+                    snapshot_array_ok(size, dirs[i].names, dirs[i].nr_names, sizeof(size_t));
+          } /*for*/
+      } /*if*/
+    if (ok)
+      {
+        items = (const struct snapshot_item *)(base + snap->items);
+        for (i = 0; ok && i < snap->nr_items; ++i)
+          {
+            ok =
+                    items[i].config <= 1
+                &&
+                    snapshot_string_ok(snap, size, items[i].itempath, false)
+                &&
+                    snapshot_string_ok(snap, size, items[i].found, false);
+          } /*for*/
+      } /*if*/
+    return
+        ok;
+  } /*snapshot_valid*/
+
+static bool snapshot_current
+  (
+    const struct snapshot_header * snap
+  )
+  /* checks that none of the search directories recorded in the snapshot has
+    changed since it was made. */
+  {
+    const char * const base = (const char *)snap;
+    const struct snapshot_dir * const dirs = (const struct snapshot_dir *)(base + snap->dirs);
+    struct stat statinfo;
+    uint32_t i;
+    bool ok = true;
+    for (i = 0; ok && i < snap->nr_dirs; ++i)
+      {
+        if (dirs[i].state != LISTING_UNKNOWN)
+          {
+            if (stat(base + dirs[i].path, &statinfo) == 0 && S_ISDIR(statinfo.st_mode))
+              {
+                ok =
+                        dirs[i].state == LISTING_PRESENT
+                    &&
+                        statinfo.st_mtim.tv_sec == dirs[i].mtime_sec
+                    &&
+                        statinfo.st_mtim.tv_nsec == dirs[i].mtime_nsec;
+              }
+            else
+              {
+                ok = dirs[i].state == LISTING_ABSENT;
+              } /*if*/
+          } /*if*/
+      } /*for*/
+    return
+        ok;
+  } /*snapshot_current*/
+
+static void snapshot_seed_listings
+  (
+    const struct snapshot_header * snap,
+    struct xdg_system * sys
+  )
+  /* primes the directory listings for sys from those in the snapshot. */
+  {
+    const char * const base = (const char *)snap;
+    const struct snapshot_dir * const dirs = (const struct snapshot_dir *)(base + snap->dirs);
+    struct dir_listing * listing;
+    size_t * hashes;
+    struct timespec now;
+    uint32_t i;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    pthread_mutex_lock(&sys->listings_lock);
+    for (i = 0; i < snap->nr_dirs; ++i)
+      {
+        if
+          (
+                dirs[i].dir_index >= 0
+            &&
+                dirs[i].dir_index < sys->nr_dirs[dirs[i].config]
+            &&
+                dirs[i].state != LISTING_UNKNOWN
+          )
+          {
+            listing = &sys->listings[dirs[i].config][dirs[i].dir_index];
+            hashes = 0;
+            if (dirs[i].nr_names != 0)
+              {
+                hashes = malloc(dirs[i].nr_names * sizeof(size_t));
+                if (hashes == 0)
+                    continue; /* just leave it to be listed as usual */
+                memcpy(hashes, base + dirs[i].names, dirs[i].nr_names * sizeof(size_t));
+              } /*if*/
+            free(listing->name_hashes);
+            listing->name_hashes = hashes;
+            listing->nr_names = dirs[i].nr_names;
+            listing->state = dirs[i].state;
+            listing->racy = dirs[i].racy;
+            listing->mtime.tv_sec = dirs[i].mtime_sec;
+            listing->mtime.tv_nsec = dirs[i].mtime_nsec;
+            listing->checked = now;
+            listing->listed = true;
+          } /*if*/
+      } /*for*/
+    pthread_mutex_unlock(&sys->listings_lock);
+  } /*snapshot_seed_listings*/
+
+static void snapshot_import(void)
+  /* picks up a context snapshot passed down by the parent process, if there is one
+    and it still applies. Called once, on first use of the default context. */
+  {
+    const int save_errno = errno;
+    const char * const fdstr = getenv(XDG_CONTEXT_FD_ENV);
+    struct snapshot_header * snap = MAP_FAILED;
+    struct xdg_system * sys = 0;
+    size_t size = 0;
+    do /*once*/
+      {
+        char * endp;
+        long fd;
+        int seals;
+        struct stat statinfo;
+        if (fdstr == 0 || fdstr[0] == '\0')
+            break;
+        fd = strtol(fdstr, &endp, 10);
+        if (*endp != '\0' || fd < 0 || fd > INT_MAX)
+            break;
+        seals = fcntl(fd, F_GET_SEALS);
+        if (seals < 0 || (seals & CONTEXT_SNAPSHOT_SEALS) != CONTEXT_SNAPSHOT_SEALS)
+            break; /* not a sealed memfd, so not one of mine */
+        if
+          (
+                fstat(fd, &statinfo) != 0
+            ||
+                statinfo.st_uid != geteuid()
+                  /* memfd belongs to whoever created it, which is the one thing about
+                    it that cannot be forged by whoever passed down the fd number */
+            ||
+                statinfo.st_size < sizeof(struct snapshot_header)
+            ||
+                statinfo.st_size > UINT32_MAX
+          )
+            break;
+        size = statinfo.st_size;
+        snap = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (snap == MAP_FAILED)
+            break;
+        if
+          (
+                !snapshot_valid(snap, size)
+            ||
+                snap->uid != statinfo.st_uid /* just a consistency check */
+            ||
+                snapshot_expired(snap)
+          )
+            break;
+        sys = context_system(0);
+        if
+          (
+                sys == 0
+            ||
+                strcmp(sys->config_dirs, (const char *)snap + snap->config_dirs) != 0
+            ||
+                strcmp(sys->data_dirs, (const char *)snap + snap->data_dirs) != 0
+            ||
+                !snapshot_current(snap)
+          )
+            break;
+        snapshot_seed_listings(snap, sys);
+        snapshot_system = sys; /* keep reference */
+        sys = 0;
+        snapshot = snap;
+        snap = MAP_FAILED;
+      }
+    while (false);
+    context_system_release(0, sys);
+    if (snap != MAP_FAILED)
+      {
+        munmap(snap, size);
+      } /*if*/
+    errno = save_errno;
+  } /*snapshot_import*/
+
+static const char * snapshot_lookup
+  (
+    const xdg_context * ctx,
+    const char * itempath,
+    bool config /* true for config, false for data */
+  )
+  /* looks for itempath in the context snapshot inherited from the parent process,
+    returning where it was found if that applies and the item is still there, or NULL
+    if it has to be searched for as usual. Once a recorded item turns out to be gone,
+    or the snapshot expires, the snapshot is not consulted again. */
+  {
+    const int save_errno = errno;
+    const char * result = 0;
+    if (ctx == 0)
+      {
+        pthread_once(&snapshot_once, snapshot_import);
+      } /*if*/
+    if
+      (
+            ctx == 0
+        &&
+            snapshot != 0
+        &&
+            !__atomic_load_n(&snapshot_stale, __ATOMIC_RELAXED)
+      )
+      {
+        const char * const base = (const char *)snapshot;
+        const struct snapshot_item * const items =
+            (const struct snapshot_item *)(base + snapshot->items);
+        const uint32_t snap_home = config ? snapshot->config_home : snapshot->data_home;
+        struct xdg_system * const sys = context_system(0);
+        char * const home =
+            config ?
+                xdg_context_get_config_home(0, false)
+            :
+                xdg_context_get_data_home(0, false);
+        struct stat statinfo;
+        uint32_t i;
+        if (snapshot_expired(snapshot))
+          {
+            __atomic_store_n(&snapshot_stale, true, __ATOMIC_RELAXED);
+          }
+        else if
+          (
+                sys == snapshot_system
+            &&
+                (home != 0 ? snap_home != 0 && strcmp(home, base + snap_home) == 0 : snap_home == 0)
+          )
+          {
+            /* environment still resolves the same way as in the exporting process */
+            for (i = 0; i < snapshot->nr_items; ++i)
+              {
+                if (items[i].config == config && strcmp(base + items[i].itempath, itempath) == 0)
+                  {
+                    if (stat(base + items[i].found, &statinfo) == 0)
+                      {
+                        result = base + items[i].found;
+                      }
+                    else
+                      {
+                        __atomic_store_n(&snapshot_stale, true, __ATOMIC_RELAXED);
+                      } /*if*/
+                    break;
+                  } /*if*/
+              } /*for*/
+          } /*if*/
+        free(home);
+        context_system_release(0, sys);
+      } /*if*/
+    errno = save_errno;
+    return
+        result;
+  } /*snapshot_lookup*/
+
+typedef int (*search_dir_action)
+  (
+    struct xdg_system * sys,
+    const char * dirpath, /* not null-terminated */
+    size_t dirpath_len,
+    int dir_index, /* position in system search path, -1 for the user area */
+    void * arg
+  );
+  /* return nonzero to abort the scan */
+
+static int for_each_search_dir
+  (
+    const xdg_context * ctx,
+    bool config, /* true for config, false for data */
+    search_dir_action action,
+    void * actionarg,
+    bool forwards /* false to do in reverse */
+  )
+  /* invokes action for the user area and then each system directory for ctx, or in
+    the reverse order if not forwards. Returns nonzero on error, or if action
+    returned nonzero. */
+  {
+    int status = 0;
+    struct xdg_system * sys;
+    int dir_index;
+    int do_component
+      (
+        const unsigned char * dirpath,
+        size_t dirpath_len,
+        void * unused
+      )
+      {
+        const int this_index = dir_index;
+        dir_index += forwards ? 1 : -1;
+        return
+            action(sys, (const char *)dirpath, dirpath_len, this_index, actionarg);
+      } /*do_component*/;
+
+    const char * home_path;
+    if (ctx == 0)
+      {
+        pthread_once(&snapshot_once, snapshot_import);
+      } /*if*/
+    sys = context_system(ctx);
+    dir_index = forwards || sys == 0 ? 0 : sys->nr_dirs[config] - 1;
+    home_path =
+        config ?
+            xdg_context_get_config_home(ctx, false)
+        :
+            xdg_context_get_data_home(ctx, false);
+    do /*once*/
+      {
+        const char * search_path;
+        if (sys == 0)
+          {
+            errno = ENOMEM;
+            status = -1;
+            break;
+          } /*if*/
+        search_path = config ? sys->config_dirs : sys->data_dirs;
+        if (forwards && home_path != 0)
+          {
+            status = action(sys, home_path, strlen(home_path), -1, actionarg);
+            if (status != 0)
+                break;
+          } /*if*/
+        status = xdg_for_each_path_component
+          (
+            /*path =*/ (const unsigned char *)search_path,
+            /*path_len =*/ strlen(search_path),
+            /*action =*/ do_component,
+            /*actionarg =*/ 0,
+            /*forwards =*/ forwards
+          );
+        if (status != 0)
+            break;
+        if (!forwards && home_path != 0)
+          {
+            status = action(sys, home_path, strlen(home_path), -1, actionarg);
+            if (status != 0)
+                break;
+          } /*if*/
+      }
+    while (false);
+    free((void *)home_path);
+    context_system_release(ctx, sys);
+    return
+        status;
+  } /*for_each_search_dir*/
+
+static char * item_path_in_dir
+  (
+    const char * dirpath, /* not null-terminated */
+    size_t dirpath_len,
+    const char * itempath
+  )
+  /* returns the full path to itempath within the specified directory, or NULL if
+    out of memory. Caller must dispose of the result pointer. */
+  {
+    const size_t thispath_maxlen = dirpath_len + 1 + strlen(itempath) + 1;
+    char * const thispath = malloc(thispath_maxlen);
+    if (thispath != 0)
+      {
+        memcpy(thispath, dirpath, dirpath_len);
+        thispath[dirpath_len] = 0;
+        if (dirpath_len != 0 && dirpath[dirpath_len - 1] != '/')
+          {
+            strconcat(thispath, thispath_maxlen, "/");
+          } /*if*/
+        strconcat(thispath, thispath_maxlen, itempath);
+      } /*if*/
+    return
+        thispath;
+  } /*item_path_in_dir*/
+
+static int xdg_for_each_found
+  (
+    const xdg_context * ctx,
+    const char * itempath, /* relative path of item to look for in each directory */
+    bool config, /* true for config, false for data */
+    xdg_item_path_action action,
+    void * actionarg,
+    bool forwards /* false to do in reverse */
+  )
+  {
+    int try_component
+      (
+        struct xdg_system * sys,
+        const char * dirpath,
+        size_t dirpath_len,
+        int dir_index,
+        void * unused
+      )
+      /* generates the full item path, and passes it to the caller's action
+        if it is accessible. */
+      {
+        char * thispath = 0;
+        struct stat statinfo;
+        int status = 0;
+        do /*once*/
+          {
+            if (!listing_may_contain(sys, config, dir_index, dirpath, dirpath_len, itempath))
+                break;
+            thispath = item_path_in_dir(dirpath, dirpath_len, itempath);
+            if (thispath == 0)
+              {
+                status = -1;
+                break;
+              } /*if*/
+            if (sys->backend->stat(sys->backend, thispath, &statinfo) == 0)
+              {
+                status = action(thispath, actionarg);
+              }
+            else
+              {
+                errno = 0; /* ignore stat result */
+              } /*if*/
+          }
+        while (false);
+        free(thispath);
+        return
+            status;
+      } /*try_component*/;
+
+    return
+        for_each_search_dir(ctx, config, try_component, 0, forwards);
+  } /*xdg_for_each_found*/
+
+static char * xdg_find_first_path
+  (
+    const xdg_context * ctx,
+    const char * itempath, /* assumed relative */
+    bool config /* true for config, false for data */
+  )
+  /* common internal routine for both xdg_context_find_first_config_path and
+    xdg_context_find_first_data_path. */
+  {
+    char * result = 0;
+    const char * recorded;
+    errno = 0;
+    int save_item
+      (
+        const char * itempath,
+        void * unused
+      )
+      {
+        result = strdup(itempath);
+        return
+            result != 0;
+      } /*save_item*/;
+    recorded = snapshot_lookup(ctx, itempath, config);
+    if (recorded != 0)
+      {
+        result = strdup(recorded);
+      }
+    else
+      {
+        (void)xdg_for_each_found
+          (
+            /*ctx =*/ ctx,
+            /*itempath =*/ itempath,
+            /*config =*/ config,
+            /*action =*/ save_item,
+            /*actionarg =*/ 0,
+            /*forwards =*/ true
+          );
+        if (result == 0 && errno == 0)
+          {
+            errno = ENOENT;
+          } /*if*/
+      } /*if*/
+    return
+        result;
+  } /*xdg_find_first_path*/
+
+char * xdg_context_find_first_config_path
+  (
+    const xdg_context * ctx,
+    const char * itempath
+  )
+  /* as for xdg_find_first_config_path, but resolving for ctx. */
+  {
+    return
+        xdg_find_first_path(ctx, itempath, true);
+  } /*xdg_context_find_first_config_path*/
+
+char * xdg_find_first_config_path
+  (
+    const char * itempath
+  )
+  /* searches for itempath in all the config directory locations in order of decreasing
+    priority, returning the expansion where it is first found, or NULL if not found.
+    Caller must dispose of the result pointer. */
+  {
+    return
+        xdg_context_find_first_config_path(0, itempath);
+  } /*xdg_find_first_config_path*/
+
+int xdg_context_find_all_config_path
+  (
+    const xdg_context * ctx,
+    const char * itempath,
+    xdg_item_path_action action,
+    void * actionarg,
+    bool forwards
+  )
+  /* as for xdg_find_all_config_path, but resolving for ctx. */
+  {
+    return
+        xdg_for_each_found
+          (
+            /*ctx =*/ ctx,
+            /*itempath =*/ itempath,
+            /*config =*/ true,
+            /*action =*/ action,
+            /*actionarg =*/ actionarg,
+            /*forwards =*/ forwards
+          );
+  } /*xdg_context_find_all_config_path*/
+
+int xdg_find_all_config_path
+  (
+    const char * itempath, /* relative path of item to look for in each directory */
+    xdg_item_path_action action,
+    void * actionarg,
+    bool forwards /* false to do in reverse */
+  )
+  /* searches for itempath in all the config directory locations, and invokes the
+    specified action for each instance found. Returns nonzero on error, or if action
+    returned nonzero. */
+  {
+    return
+        xdg_context_find_all_config_path(0, itempath, action, actionarg, forwards);
+  } /*xdg_find_all_config_path*/
+
+char * xdg_context_find_first_data_path
+  (
+    const xdg_context * ctx,
+    const char * itempath
+  )
+  /* as for xdg_find_first_data_path, but resolving for ctx. */
+  {
+    return
+        xdg_find_first_path(ctx, itempath, false);
+  } /*xdg_context_find_first_data_path*/
+
+char * xdg_find_first_data_path
+  (
+    const char * itempath
+  )
+  /* searches for itempath in all the data directory locations in order of decreasing
+    priority, returning the expansion where it is first found, or NULL if not found.
+    Caller must dispose of the result pointer. */
+  {
+    return
+        xdg_context_find_first_data_path(0, itempath);
+  } /*xdg_find_first_data_path*/
+
+int xdg_context_find_all_data_path
+  (
+    const xdg_context * ctx,
+    const char * itempath,
+    xdg_item_path_action action,
+    void * actionarg,
+    bool forwards
+  )
+  /* as for xdg_find_all_data_path, but resolving for ctx. */
+  {
+    return
+        xdg_for_each_found
+          (
+            /*ctx =*/ ctx,
+            /*itempath =*/ itempath,
+            /*config =*/ false,
+            /*action =*/ action,
+            /*actionarg =*/ actionarg,
+            /*forwards =*/ forwards
+          );
+  } /*xdg_context_find_all_data_path*/
+
+int xdg_find_all_data_path
+  (
+    const char * itempath, /* relative path of item to look for in each directory */
+    xdg_item_path_action action,
+    void * actionarg,
+    bool forwards /* false to do in reverse */
+  )
+  /* searches for itempath in all the data directory locations, and invokes the
+    specified action for each instance found. Returns nonzero on error, or if action
+    returned nonzero. */
+  {
+    return
+        xdg_context_find_all_data_path(0, itempath, action, actionarg, forwards);
+  } /*xdg_find_all_data_path*/
+
+static char * find_first_variant
+  (
+    const xdg_context * ctx,
+    const char * const * candidates, /* NULL-terminated */
+    bool config, /* true for config, false for data */
+    xdg_variant_policy policy,
+    int * which
+  )
+  /* common internal routine for xdg_context_find_first_variant_config_path and
+    xdg_context_find_first_variant_data_path. */
+  {
+    char * pathbuf = 0; /* reused for every directory */
+    size_t pathbuf_size = 0;
+    size_t candidate_maxlen = 0;
+    int nr_candidates;
+    int best; /* index of best candidate found so far, nr_candidates if none */
+    char * result = 0;
+    int try_component
+      (
+        struct xdg_system * sys,
+        const char * dirpath,
+        size_t dirpath_len,
+        int dir_index,
+        void * unused
+      )
+      /* tries the candidates that could still beat the best so far in this directory,
+        stopping the scan once the winner is certain. */
+      {
+        const size_t needed = dirpath_len + 1 + candidate_maxlen + 1;
+        const size_t prefix_len =
+            dirpath_len != 0 && dirpath[dirpath_len - 1] != '/' ?
+                dirpath_len + 1
+            :
+                dirpath_len;
+          /* same rule as item_path_in_dir */
+        struct stat statinfo;
+        int status = 0;
+        int i;
+        do /*once*/
+          {
+            if (needed > pathbuf_size)
+              {
+                char * const new_pathbuf = realloc(pathbuf, needed);
+                if (new_pathbuf == 0)
+                  {
+                    status = -1;
+                    break;
+                  } /*if*/
+                pathbuf = new_pathbuf;
+                pathbuf_size = needed;
+              } /*if*/
+            memcpy(pathbuf, dirpath, dirpath_len);
+            if (prefix_len > dirpath_len)
+              {
+                pathbuf[dirpath_len] = '/';
+              } /*if*/
+            for (i = 0; i < best; ++i)
+              {
+                if (listing_may_contain(sys, config, dir_index, dirpath, dirpath_len, candidates[i]))
+                  {
+                    strcpy(pathbuf + prefix_len, candidates[i]);
+                    if (sys->backend->stat(sys->backend, pathbuf, &statinfo) == 0)
+                      {
+                        best = i;
+                        free(result);
+                        result = strdup(pathbuf);
+                        if (result == 0)
+                          {
+                            status = -1;
+                          } /*if*/
+                        break;
+                      } /*if*/
+                    errno = 0; /* ignore stat result */
+                  } /*if*/
+              } /*for*/
+            if (status != 0)
+                break;
+            if
+              (
+                    best == 0
+                ||
+                    (policy == XDG_VARIANT_DIRECTORY_MAJOR && best < nr_candidates)
+              )
+              {
+                status = 1; /* no need to look any further */
+              } /*if*/
+          }
+        while (false);
+        return
+            status;
+      } /*try_component*/;
+
+    errno = 0;
+    for (nr_candidates = 0; candidates[nr_candidates] != 0; ++nr_candidates)
+      {
+        const size_t candidate_len = strlen(candidates[nr_candidates]);
+        if (candidate_len > candidate_maxlen)
+          {
+            candidate_maxlen = candidate_len;
+          } /*if*/
+      } /*for*/
+    best = nr_candidates;
+    if (for_each_search_dir(ctx, config, try_component, 0, true) < 0)
+      {
+        free(result);
+        result = 0;
+      } /*if*/
+    free(pathbuf);
+    if (result != 0)
+      {
+        if (which != 0)
+          {
+            *which = best;
+          } /*if*/
+      }
+    else if (errno == 0)
+      {
+        errno = ENOENT;
+      } /*if*/
+    return
+        result;
+  } /*find_first_variant*/
+
+char * xdg_context_find_first_variant_config_path
+  (
+    const xdg_context * ctx,
+    const char * const * candidates,
+    xdg_variant_policy policy,
+    int * which
+  )
+  /* as for xdg_find_first_variant_config_path, but resolving for ctx. */
+  {
+    return
+        find_first_variant(ctx, candidates, true, policy, which);
+  } /*xdg_context_find_first_variant_config_path*/
+
+char * xdg_find_first_variant_config_path
+  (
+    const char * const * candidates,
+    xdg_variant_policy policy,
+    int * which
+  )
+  /* searches all the config directory locations for the best match among the
+    NULL-terminated list of candidate item paths, given in decreasing order of
+    preference, in a single pass. With XDG_VARIANT_DIRECTORY_MAJOR, the match is
+    the most preferred candidate in the highest-priority directory holding any of
+    them; with XDG_VARIANT_CANDIDATE_MAJOR, it is the highest-priority instance of the
+    most preferred candidate found anywhere. Returns the expansion of the match,
+    setting *which (if which is not NULL) to its index in candidates, or NULL if
+    none is found. Caller must dispose of the result pointer. */
+  {
+    return
+        xdg_context_find_first_variant_config_path(0, candidates, policy, which);
+  } /*xdg_find_first_variant_config_path*/
+
+char * xdg_context_find_first_variant_data_path
+  (
+    const xdg_context * ctx,
+    const char * const * candidates,
+    xdg_variant_policy policy,
+    int * which
+  )
+  /* as for xdg_find_first_variant_data_path, but resolving for ctx. */
+  {
+    return
+        find_first_variant(ctx, candidates, false, policy, which);
+  } /*xdg_context_find_first_variant_data_path*/
+
+char * xdg_find_first_variant_data_path
+  (
+    const char * const * candidates,
+    xdg_variant_policy policy,
+    int * which
+  )
+  /* as for xdg_find_first_variant_config_path, but searching the data directory
+    locations. */
+  {
+    return
+        xdg_context_find_first_variant_data_path(0, candidates, policy, which);
+  } /*xdg_find_first_variant_data_path*/
+
+char * xdg_context_find_cache_path
+  (
+    const xdg_context * ctx,
+    const char * itempath,
+    bool create_if
+  )
+  /* as for xdg_find_cache_path, but resolving for ctx. */
+  {
+    const char * const cache_home = xdg_context_get_cache_home(ctx, false);
+    char * result = 0;
+    if (cache_home != 0)
+      {
+        result = path_join(cache_home, itempath);
+        if (result != 0 && create_if && context_makedirsif(ctx, result) != 0)
+          {
+            free(result);
+            result = 0;
+          } /*if*/
+        free((void *)cache_home);
+      } /*if*/
+    return
+        result;
+  } /*xdg_context_find_cache_path*/
+
+char * xdg_find_cache_path
+  (
+    const char * itempath,
+    bool create_if
+  )
+  /* returns an expansion for itempath in the cache directory area. Caller must
+    dispose of the result pointer. */
+  {
+    return
+        xdg_context_find_cache_path(0, itempath, create_if);
+  } /*xdg_find_cache_path*/
+
+void xdg_flush_listings(void)
+  /* forgets everything remembered about the contents of system search directories,
+    for all contexts, so that subsequent lookups see any changes immediately. */
+  {
+    struct xdg_system * sys;
+    struct dir_listing * listing;
+    int config;
+    size_t i;
+    pthread_mutex_lock(&systems_lock);
+    for (sys = systems; sys != 0; sys = sys->next)
+      {
+        pthread_mutex_lock(&sys->listings_lock);
+        for (config = 0; config < 2; ++config)
+          {
+            for (i = 0; i < sys->nr_dirs[config]; ++i)
+              {
+                listing = &sys->listings[config][i];
+                listing->listed = false;
+                listing->state = LISTING_UNKNOWN;
+              } /*for*/
+          } /*for*/
+        pthread_mutex_unlock(&sys->listings_lock);
+      } /*for*/
+    pthread_mutex_unlock(&systems_lock);
+  } /*xdg_flush_listings*/
+
+struct snapshot_buf
+  /* a context snapshot being built. */
+  {
+    char * data;
+    size_t len, alloc;
+    bool failed; /* errno has been set */
+  };
+
+static uint32_t snapshot_add
+  (
+    struct snapshot_buf * buf,
+    const void * data, /* NULL to add zeroes */
+    size_t len
+  )
+  /* appends len bytes to buf at the next 8-byte boundary, returning their offset. */
+  {
+    const size_t offset = (buf->len + 7) & ~(size_t)7;
+    uint32_t result = 0;
+    if (!buf->failed)
+      {
+        if (offset + len > UINT32_MAX)
+          {
+            errno = EFBIG;
+            buf->failed = true;
+          }
+        else if (offset + len > buf->alloc)
+          {
+            size_t new_alloc = buf->alloc != 0 ? buf->alloc : 4096;
+            char * new_data;
+            while (new_alloc < offset + len)
+              {
+                new_alloc *= 2;
+              } /*while*/
+            new_data = realloc(buf->data, new_alloc);
+            if (new_data != 0)
+              {
+                buf->data = new_data;
+                buf->alloc = new_alloc;
+              }
+            else
+              {
+                buf->failed = true;
+              } /*if*/
+          } /*if*/
+      } /*if*/
+    if (!buf->failed)
+      {
+        memset(buf->data + buf->len, 0, offset - buf->len);
+        if (data != 0)
+          {
+            memcpy(buf->data + offset, data, len);
+          }
+        else
+          {
+            memset(buf->data + offset, 0, len);
+          } /*if*/
+        buf->len = offset + len;
+        result = offset;
+      } /*if*/
+    return
+        result;
+  } /*snapshot_add*/
+
+static uint32_t snapshot_add_string
+  (
+    struct snapshot_buf * buf,
+    const char * str, /* may be NULL */
+    size_t len
+  )
+  /* appends a null-terminated copy of the first len bytes of str, returning its
+    offset, or 0 if str is NULL. */
+  {
+    uint32_t result = 0;
+    if (str != 0)
+      {
+        result = snapshot_add(buf, 0, len + 1);
+        if (!buf->failed)
+          {
+            memcpy(buf->data + result, str, len);
+          } /*if*/
+      } /*if*/
+    return
+        result;
+  } /*snapshot_add_string*/
+
+int xdg_context_export
+  (
+    const xdg_context * ctx,
+    const char * const * config_items,
+    const char * const * data_items
+  )
+  /* as for xdg_export, but capturing the resolution for ctx. This is only possible
+    for contexts using the live filesystem, and fails with EPERM if ctx is for some
+    other user, since the snapshot would belong to the calling process. */
+  {
+    struct snapshot_buf buf = {0, 0, 0, false};
+    struct xdg_system * const sys = context_system(ctx);
+    char * const homes[2] = /* indexed by config */
+      {
+        xdg_context_get_data_home(ctx, false),
+        xdg_context_get_config_home(ctx, false),
+      };
+    uint32_t nr_items = 0;
+    uint32_t nr_dirs, dirs, items;
+    uint32_t dir_nr, item_nr;
+    uint32_t strings[4];
+    struct snapshot_header * header;
+    struct snapshot_dir * thisdir;
+    struct snapshot_item * thisitem;
+    int config;
+    size_t i;
+    int fd = -1;
+    int add_dir
+      (
+        const unsigned char * dirpath,
+        size_t dirpath_len,
+        void * arg
+      )
+      /* records what is known about the next system search directory. */
+      {
+        const int dir_index = *(int *)arg;
+        const uint32_t pathoffset = snapshot_add_string(&buf, (const char *)dirpath, dirpath_len);
+        struct dir_listing listing = {.state = LISTING_UNKNOWN};
+        uint32_t names = 0;
+        if (listing_applicable(dir_index, (const char *)dirpath, dirpath_len))
+          {
+            pthread_mutex_lock(&sys->listings_lock);
+            listing = *listing_get(sys, config, dir_index, (const char *)dirpath, dirpath_len);
+            names = snapshot_add(&buf, listing.name_hashes, listing.nr_names * sizeof(size_t));
+            pthread_mutex_unlock(&sys->listings_lock);
+          } /*if*/
+        if (!buf.failed)
+          {
+            thisdir = (struct snapshot_dir *)(buf.data + dirs) + dir_nr;
+            thisdir->dir_index = dir_index;
+            thisdir->config = config;
+            thisdir->state = listing.state;
+            thisdir->racy = listing.racy;
+            thisdir->path = pathoffset;
+            thisdir->nr_names = listing.nr_names;
+            thisdir->names = names;
+            thisdir->mtime_sec = listing.mtime.tv_sec;
+            thisdir->mtime_nsec = listing.mtime.tv_nsec;
+            ++dir_nr;
+          } /*if*/
+        ++*(int *)arg;
+        return
+            buf.failed ? -1 : 0;
+      } /*add_dir*/;
+
+    errno = 0;
+    do /*once*/
+      {
+        if (sys == 0)
+          {
+            errno = ENOMEM;
+            break;
+          } /*if*/
+        if (sys->backend != &posix_backend)
+          {
+            errno = EINVAL; /* children couldn't make use of it */
+            break;
+          } /*if*/
+        if (context_uid(ctx) != geteuid())
+          {
+            errno = EPERM; /* children only trust snapshots their own user created */
+            break;
+          } /*if*/
+        for (config = 0; config < 2; ++config)
+          {
+            const char * const * itempaths = config ? config_items : data_items;
+            if (itempaths != 0)
+              {
+                for (i = 0; itempaths[i] != 0; ++i)
+                  {
+                    ++nr_items;
+                  } /*for*/
+              } /*if*/
+          } /*for*/
+        nr_dirs = 2 + sys->nr_dirs[true] + sys->nr_dirs[false];
+        (void)snapshot_add(&buf, 0, sizeof(struct snapshot_header));
+        dirs = snapshot_add(&buf, 0, nr_dirs * sizeof(struct snapshot_dir));
+        items = snapshot_add(&buf, 0, nr_items * sizeof(struct snapshot_item));
+        if (buf.failed)
+            break;
+      /* resolve the items first, so the listings used are all fresh */
+        item_nr = 0;
+        for (config = 0; config < 2 && !buf.failed; ++config)
+          {
+            const char * const * itempaths = config ? config_items : data_items;
+            for (i = 0; itempaths != 0 && itempaths[i] != 0; ++i)
+              {
+                char * const found = xdg_find_first_path(ctx, itempaths[i], config);
+                uint32_t itempath, foundoffset;
+                if (found == 0)
+                  {
+                    if (errno != ENOENT)
+                      {
+                        buf.failed = true;
+                        break;
+                      } /*if*/
+                    errno = 0;
+                    continue;
+                  } /*if*/
+                itempath = snapshot_add_string(&buf, itempaths[i], strlen(itempaths[i]));
+                foundoffset = snapshot_add_string(&buf, found, strlen(found));
+                free(found);
+                if (buf.failed)
+                    break;
+                thisitem = (struct snapshot_item *)(buf.data + items) + item_nr++;
+                thisitem->config = config;
+                thisitem->itempath = itempath;
+                thisitem->found = foundoffset;
+              } /*for*/
+          } /*for*/
+        if (buf.failed)
+            break;
+        dir_nr = 0;
+        for (config = 0; config < 2 && !buf.failed; ++config)
+          {
+          /* user area, compared but not listed */
+            struct stat statinfo;
+            const char * const home = homes[config] != 0 ? homes[config] : "";
+            const uint32_t pathoffset = snapshot_add_string(&buf, home, strlen(home));
+            int dir_index = 0;
+            if (buf.failed)
+                break;
+            thisdir = (struct snapshot_dir *)(buf.data + dirs) + dir_nr++;
+            thisdir->dir_index = -1;
+            thisdir->config = config;
+            thisdir->state = LISTING_UNKNOWN;
+            thisdir->path = pathoffset;
+            if (home[0] == '/')
+              {
+                if (stat(home, &statinfo) != 0)
+                  {
+                    if (errno == ENOENT || errno == ENOTDIR)
+                      {
+                        thisdir->state = LISTING_ABSENT;
+                      } /*if*/
+                    errno = 0;
+                  }
+                else if (S_ISDIR(statinfo.st_mode))
+                  {
+                    thisdir->state = LISTING_PRESENT;
+                    thisdir->mtime_sec = statinfo.st_mtim.tv_sec;
+                    thisdir->mtime_nsec = statinfo.st_mtim.tv_nsec;
+                  }
+                else
+                  {
+                    thisdir->state = LISTING_ABSENT;
+                  } /*if*/
+              } /*if*/
+          /* system search directories */
+            (void)xdg_for_each_path_component
+              (
+                /*path =*/ (const unsigned char *)(config ? sys->config_dirs : sys->data_dirs),
+                /*path_len =*/ strlen(config ? sys->config_dirs : sys->data_dirs),
+                /*action =*/ add_dir,
+                /*actionarg =*/ &dir_index,
+                /*forwards =*/ true
+              );
+          } /*for*/
+        if (buf.failed)
+            break;
+        strings[0] = snapshot_add_string(&buf, homes[true], homes[true] != 0 ? strlen(homes[true]) : 0);
+        strings[1] = snapshot_add_string(&buf, homes[false], homes[false] != 0 ? strlen(homes[false]) : 0);
+        strings[2] = snapshot_add_string(&buf, sys->config_dirs, strlen(sys->config_dirs));
+        strings[3] = snapshot_add_string(&buf, sys->data_dirs, strlen(sys->data_dirs));
+        if (buf.failed)
+            break;
+        header = (struct snapshot_header *)buf.data;
+        memcpy(header->magic, CONTEXT_SNAPSHOT_MAGIC, sizeof header->magic);
+        header->size = buf.len;
+        header->uid = context_uid(ctx);
+          {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            header->created_sec = now.tv_sec;
+            header->created_nsec = now.tv_nsec;
+          }
+        header->config_home = strings[0];
+        header->data_home = strings[1];
+        header->config_dirs = strings[2];
+        header->data_dirs = strings[3];
+        header->nr_dirs = dir_nr;
+        header->dirs = dirs;
+        header->nr_items = item_nr;
+        header->items = items;
+        fd = memfd_create("xdg-context", MFD_ALLOW_SEALING);
+        if (fd < 0)
+            break;
+        for (i = 0; i < buf.len;)
+          {
+            const ssize_t written = write(fd, buf.data + i, buf.len - i);
+            if (written < 0)
+              {
+                if (errno == EINTR)
+                    continue;
+                break;
+              } /*if*/
+            i += written;
+          } /*for*/
+        if (i < buf.len || fcntl(fd, F_ADD_SEALS, CONTEXT_SNAPSHOT_SEALS) != 0)
+          {
+            close_keep_errno(fd);
+            fd = -1;
+            break;
+          } /*if*/
+      }
+    while (false);
+    free(buf.data);
+    free(homes[false]);
+    free(homes[true]);
+    context_system_release(ctx, sys);
+    return
+        fd;
+  } /*xdg_context_export*/
+
+int xdg_export
+  (
+    const char * const * config_items,
+    const char * const * data_items
+  )
+  /* captures everything known about resolving config and data paths for the calling
+    process into a sealed anonymous file, including where the items in config_items
+    and data_items (each NULL-terminated, or NULL if none) were found, and returns its
+    file descriptor, which is not close-on-exec. Pass its number to child processes
+    in the environment variable named by XDG_CONTEXT_FD_ENV; they make use of it only
+    if they run under the same effective user ID that created it, and only for the
+    first few seconds after export. Returns -1 and sets errno on error. */
+  {
+    return
+        xdg_context_export(0, config_items, data_items);
+  } /*xdg_export*/
+
+static int open_first_path
+  (
+    const xdg_context * ctx,
+    const char * itempath, /* assumed relative */
+    bool config, /* true for config, false for data */
+    int flags,
+    char ** path
+  )
+  /* common internal routine for xdg_context_open_first_config_path and
+    xdg_context_open_first_data_path. */
+  {
+    int fd = -1;
+    char * found = 0;
+    int try_component
+      (
+        struct xdg_system * sys,
+        const char * dirpath,
+        size_t dirpath_len,
+        int dir_index,
+        void * unused
+      )
+      /* tries opening the item in this directory, stopping the scan if successful. */
+      {
+        char * thispath;
+        int status = 0;
+        if (listing_may_contain(sys, config, dir_index, dirpath, dirpath_len, itempath))
+          {
+            thispath = item_path_in_dir(dirpath, dirpath_len, itempath);
+            if (thispath != 0)
+              {
+                fd = sys->backend->open(sys->backend, thispath, flags | O_CLOEXEC, 0);
+                if (fd >= 0)
+                  {
+                    found = thispath;
+                    status = 1;
+                  }
+                else
+                  {
+                    free(thispath);
+                    errno = 0; /* ignore open result */
+                  } /*if*/
+              }
+            else
+              {
+                status = -1;
+              } /*if*/
+          } /*if*/
+        return
+            status;
+      } /*try_component*/;
+
+    const char * const recorded = snapshot_lookup(ctx, itempath, config);
+    errno = 0;
+    if (recorded != 0)
+      {
+        found = strdup(recorded);
+        if (found != 0)
+          {
+            fd = open(found, flags | O_CLOEXEC);
+            if (fd < 0)
+              {
+                free(found);
+                found = 0;
+                errno = 0; /* recorded result no longer valid, try searching */
+              } /*if*/
+          } /*if*/
+      } /*if*/
+    if (fd < 0 && errno == 0)
+      {
+        (void)for_each_search_dir(ctx, config, try_component, 0, true);
+      } /*if*/
+    if (fd >= 0)
+      {
+        (void)posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+          /* kicks off asynchronous readahead of the whole file; this is only a
+            hint, and not meaningful for everything that can be opened, so
+            errors are ignored. */
+        if (path != 0)
+          {
+            *path = found;
+          }
+        else
+          {
+            free(found);
+          } /*if*/
+      }
+    else
+      {
+        if (errno == 0)
+          {
+            errno = ENOENT;
+          } /*if*/
+        if (path != 0)
+          {
+            *path = 0;
+          } /*if*/
+      } /*if*/
+    return
+        fd;
+  } /*open_first_path*/
+
+int xdg_context_open_first_config_path
+  (
+    const xdg_context * ctx,
+    const char * itempath,
+    int flags,
+    char ** path
+  )
+  /* as for xdg_open_first_config_path, but resolving for ctx. */
+  {
+    return
+        open_first_path(ctx, itempath, true, flags, path);
+  } /*xdg_context_open_first_config_path*/
+
+int xdg_open_first_config_path
+  (
+    const char * itempath,
+    int flags,
+    char ** path
+  )
+  /* searches for itempath in all the config directory locations in order of
+    decreasing priority, as for xdg_find_first_config_path, but opens the item
+    found with the specified open(2) flags (plus O_CLOEXEC) and returns the fd, with
+    readahead of its contents already started. Each candidate is probed by opening it
+    directly, rather than doing a stat followed by an open; one that exists but
+    cannot be opened is skipped. If path is not NULL, *path is set to the expansion
+    that was opened, or NULL if none; caller must dispose of it. Returns -1 and sets
+    errno on error (ENOENT if not found). */
+  {
+    return
+        xdg_context_open_first_config_path(0, itempath, flags, path);
+  } /*xdg_open_first_config_path*/
+
+int xdg_context_open_first_data_path
+  (
+    const xdg_context * ctx,
+    const char * itempath,
+    int flags,
+    char ** path
+  )
+  /* as for xdg_open_first_data_path, but resolving for ctx. */
+  {
+    return
+        open_first_path(ctx, itempath, false, flags, path);
+  } /*xdg_context_open_first_data_path*/
+
+int xdg_open_first_data_path
+  (
+    const char * itempath,
+    int flags,
+    char ** path
+  )
+  /* searches for itempath in all the data directory locations in order of
+    decreasing priority, as for xdg_find_first_data_path, but opens the item
+    found with the specified open(2) flags (plus O_CLOEXEC) and returns the fd, with
+    readahead of its contents already started. Each candidate is probed by opening it
+    directly, rather than doing a stat followed by an open; one that exists but
+    cannot be opened is skipped. If path is not NULL, *path is set to the expansion
+    that was opened, or NULL if none; caller must dispose of it. Returns -1 and sets
+    errno on error (ENOENT if not found). */
+  {
+    return
+        xdg_context_open_first_data_path(0, itempath, flags, path);
+  } /*xdg_open_first_data_path*/
+
+#define PREFETCH_MAX_THREADS 8
+  /* including the calling thread */
+
+struct prefetch_batch
+  {
+    const xdg_context * ctx;
+    const char * const * itempaths;
+    size_t nr_items;
+    bool config;
+    int flags;
+    int * fds;
+    char ** paths;
+    size_t next_item; /* claimed atomically */
+    size_t nr_opened; /* updated atomically */
+  };
+
+static void * prefetch_worker
+  (
+    void * arg
+  )
+  /* claims and resolves items from the batch until there are none left. */
+  {
+    struct prefetch_batch * const batch = arg;
+    for (;;)
+      {
+        const size_t i = __atomic_fetch_add(&batch->next_item, 1, __ATOMIC_RELAXED);
+        if (i >= batch->nr_items)
+            break;
+        batch->fds[i] = open_first_path
+          (
+            /*ctx =*/ batch->ctx,
+            /*itempath =*/ batch->itempaths[i],
+            /*config =*/ batch->config,
+            /*flags =*/ batch->flags,
+            /*path =*/ batch->paths != 0 ? &batch->paths[i] : 0
+          );
+        if (batch->fds[i] >= 0)
+          {
+            __atomic_fetch_add(&batch->nr_opened, 1, __ATOMIC_RELAXED);
+          } /*if*/
+      } /*for*/
+    return
+        0;
+  } /*prefetch_worker*/
+
+static int prefetch_paths
+  (
+    const xdg_context * ctx,
+    const char * const * itempaths,
+    size_t nr_items,
+    bool config, /* true for config, false for data */
+    int flags,
+    int * fds,
+    char ** paths
+  )
+  /* common internal routine for xdg_context_prefetch_config_paths and
+    xdg_context_prefetch_data_paths. */
+  {
+    pthread_t threads[PREFETCH_MAX_THREADS - 1];
+    size_t nr_threads = 0;
+    struct prefetch_batch batch =
+      {
+        .ctx = ctx,
+        .itempaths = itempaths,
+        .nr_items = nr_items,
+        .config = config,
+        .flags = flags,
+        .fds = fds,
+        .paths = paths,
+        .next_item = 0,
+        .nr_opened = 0,
+      };
+    while (nr_threads < PREFETCH_MAX_THREADS - 1 && nr_threads + 1 < nr_items)
+      {
+        if (pthread_create(&threads[nr_threads], 0, prefetch_worker, &batch) != 0)
+            break; /* make do with what we have */
+        ++nr_threads;
+      } /*while*/
+    (void)prefetch_worker(&batch); /* calling thread takes its share too */
+    while (nr_threads != 0)
+      {
+        pthread_join(threads[--nr_threads], 0);
+      } /*while*/
+    return
+        (int)batch.nr_opened;
+  } /*prefetch_paths*/
+
+int xdg_context_prefetch_config_paths
+  (
+    const xdg_context * ctx,
+    const char * const * itempaths,
+    size_t nr_items,
+    int flags,
+    int * fds,
+    char ** paths
+  )
+  /* as for xdg_prefetch_config_paths, but resolving for ctx. */
+  {
+    return
+        prefetch_paths(ctx, itempaths, nr_items, true, flags, fds, paths);
+  } /*xdg_context_prefetch_config_paths*/
+
+int xdg_prefetch_config_paths
+  (
+    const char * const * itempaths,
+    size_t nr_items,
+    int flags,
+    int * fds,
+    char ** paths
+  )
+  /* does xdg_open_first_config_path for each of the nr_items elements of itempaths,
+    spreading the work over several threads so that the directory lookups and
+    readahead for different items all proceed concurrently. fds[i] is set to the fd
+    for itempaths[i], or -1 if it was not found; if paths is not NULL, paths[i] is set
+    to the corresponding expansion, or NULL, which caller must dispose of. Returns
+    the number of items that were opened. */
+  {
+    return
+        xdg_context_prefetch_config_paths(0, itempaths, nr_items, flags, fds, paths);
+  } /*xdg_prefetch_config_paths*/
+
+int xdg_context_prefetch_data_paths
+  (
+    const xdg_context * ctx,
+    const char * const * itempaths,
+    size_t nr_items,
+    int flags,
+    int * fds,
+    char ** paths
+  )
+  /* as for xdg_prefetch_data_paths, but resolving for ctx. */
+  {
+    return
+        prefetch_paths(ctx, itempaths, nr_items, false, flags, fds, paths);
+  } /*xdg_context_prefetch_data_paths*/
+
+int xdg_prefetch_data_paths
+  (
+    const char * const * itempaths,
+    size_t nr_items,
+    int flags,
+    int * fds,
+    char ** paths
+  )
+  /* does xdg_open_first_data_path for each of the nr_items elements of itempaths,
+    spreading the work over several threads so that the directory lookups and
+    readahead for different items all proceed concurrently. fds[i] is set to the fd
+    for itempaths[i], or -1 if it was not found; if paths is not NULL, paths[i] is set
+    to the corresponding expansion, or NULL, which caller must dispose of. Returns
+    the number of items that were opened. */
+  {
+    return
+        xdg_context_prefetch_data_paths(0, itempaths, nr_items, flags, fds, paths);
+  } /*xdg_prefetch_data_paths*/
+
+#define BLOB_STORE_DIR "blobs"
+#define BLOB_STORE_STAMP ".shards"
+  /* presence of this indicates all shard subdirectories have been created */
+#define BLOB_PATH_EXTRA 96
+  /* room to allow after root for "/xx/" + 62 hex digits, or a temporary name */
+#define BLOB_TEMP_PREFIX ".tmp."
+  /* start of names of blobs still being written */
+#define BLOB_TEMP_MAX_AGE 3600
+  /* seconds after which an unfinished blob is assumed abandoned by its writer */
+
+struct xdg_blob_store
+  {
+    xdg_fs_backend * backend;
+    uint64_t * bloom; /* presence filter, NULL if not in use */
+    size_t bloom_mask; /* number of bits in filter - 1 */
+    size_t root_len;
+    char root[];
+  };
+
+static void blob_path
+  (
+    const xdg_blob_store * store,
+    const unsigned char digest[XDG_BLOB_DIGEST_SIZE],
+    char * dest /* of size PATH_MAX */
+  )
+  /* puts the path for the blob with the specified digest into dest: the first
+    byte of the digest selects the shard subdirectory, and the remaining bytes
+    form the name within that. */
+  {
+    static const char hexdigits[] = "0123456789abcdef";
+    char * out = dest + store->root_len;
+    int i;
+    memcpy(dest, store->root, store->root_len);
+    for (i = 0; i < XDG_BLOB_DIGEST_SIZE; ++i)
+      {
+        if (i < 2)
+          {
+            *out++ = '/';
+          } /*if*/
+        *out++ = hexdigits[digest[i] >> 4];
+        *out++ = hexdigits[digest[i] & 15];
+      } /*for*/
+    *out = '\0';
+  } /*blob_path*/
+
+static bool bloom_probe
+  (
+    const xdg_blob_store * store,
+    const unsigned char digest[XDG_BLOB_DIGEST_SIZE],
+    bool add /* true to add digest, false to test for it */
+  )
+  /* the digest is already uniformly distributed, so the filter probes simply take
+    successive 64-bit chunks of it as bit numbers. Returns true if digest is
+    possibly present, false if it is definitely absent. */
+  {
+    bool present = true;
+    int i;
+    for (i = 0; i < XDG_BLOB_DIGEST_SIZE; i += 8)
+      {
+        uint64_t bitnr;
+        uint64_t bit;
+        memcpy(&bitnr, digest + i, 8);
+        bitnr &= store->bloom_mask;
+        bit = (uint64_t)1 << bitnr % 64;
+        if (add)
+          {
+            __atomic_fetch_or(&store->bloom[bitnr / 64], bit, __ATOMIC_RELAXED);
+          }
+        else if ((__atomic_load_n(&store->bloom[bitnr / 64], __ATOMIC_RELAXED) & bit) == 0)
+          {
+            present = false;
+            break;
+          } /*if*/
+      } /*for*/
+    return
+        present;
+  } /*bloom_probe*/
 
-static int xdg_for_each_found
+static int hexdigit_value
   (
-    const char * itempath, /* relative path of item to look for in each directory */
-    bool config, /* true for config, false for data */
-    xdg_item_path_action action,
-    void * actionarg,
-    bool forwards /* false to do in reverse */
+    char ch
+  )
+  {
+    return
+        ch >= '0' && ch <= '9' ?
+            ch - '0'
+        : ch >= 'a' && ch <= 'f' ?
+            ch - 'a' + 10
+        :
+            -1;
+  } /*hexdigit_value*/
+
+static int blob_store_prepare
+  (
+    xdg_blob_store * store
   )
+  /* creates the shard subdirectories if this hasn't already been done, then goes
+    through what's in them, removing temporaries abandoned by writers that never
+    finished and filling in the presence filter, if any. Returns nonzero and sets
+    errno on error. */
   {
+    char path[PATH_MAX];
+    unsigned int shard;
+    struct stat statinfo;
+    const time_t now = time(0);
     int status = 0;
-    int try_component
+    int scan_entry
       (
-        const unsigned char * dirpath,
-        size_t dirpath_len,
-        void * unused
+        const char * name,
+        void * arg
       )
-      /* generates the full item path, and passes it to the caller's action
-        if it is accessible. */
+      /* removes the entry in the shard directory if it is a stale temporary,
+        otherwise adds it to the presence filter if it is a blob. */
       {
-        char * thispath;
-        const size_t thispath_maxlen = dirpath_len + 1 + strlen(itempath) + 1;
-        struct stat statinfo;
-        int status = 0;
-        do /*once*/
+        unsigned char digest[XDG_BLOB_DIGEST_SIZE];
+        char temppath[PATH_MAX];
+        struct stat tempinfo;
+        int i;
+        if (strncmp(name, BLOB_TEMP_PREFIX, sizeof BLOB_TEMP_PREFIX - 1) == 0)
           {
-            thispath = malloc(thispath_maxlen);
-            if (thispath == 0)
+            if
+              (
+                    snprintf(temppath, sizeof temppath, "%s/%s", path, name) < sizeof temppath
+                &&
+                    store->backend->stat(store->backend, temppath, &tempinfo) == 0
+                &&
+                    now - tempinfo.st_mtime > BLOB_TEMP_MAX_AGE
+              )
               {
-                status = -1;
-                break;
+                (void)store->backend->unlink(store->backend, temppath);
+                  /* failure just means someone else got there first */
               } /*if*/
-            memcpy(thispath, dirpath, dirpath_len);
-            thispath[dirpath_len] = 0;
-            if (dirpath_len != 0 && dirpath[dirpath_len - 1] != '/')
+          }
+        else if (store->bloom != 0)
+          {
+            digest[0] = shard;
+            for (i = 1; i < XDG_BLOB_DIGEST_SIZE; ++i)
+              {
+                const int hi = hexdigit_value(name[i * 2 - 2]);
+                const int lo = hi >= 0 ? hexdigit_value(name[i * 2 - 1]) : -1;
+                if (lo < 0)
+                    break; /* not a blob */
+                digest[i] = hi << 4 | lo;
+              } /*for*/
+            if (i == XDG_BLOB_DIGEST_SIZE && name[i * 2 - 2] == '\0')
               {
-                strconcat(thispath, thispath_maxlen, "/");
+                (void)bloom_probe(store, digest, true);
               } /*if*/
-            strconcat(thispath, thispath_maxlen, itempath);
-            if (stat(thispath, &statinfo) == 0)
+          } /*if*/
+        return
+            0;
+      } /*scan_entry*/;
+
+    snprintf(path, sizeof path, "%s/" BLOB_STORE_STAMP, store->root);
+    if (store->backend->stat(store->backend, path, &statinfo) != 0)
+      {
+        int fd;
+        for (shard = 0; shard < 256; ++shard)
+          {
+            snprintf(path, sizeof path, "%s/%02x", store->root, shard);
+            status = store->backend->mkdir(store->backend, path, 0700);
+            if (status != 0 && errno != EEXIST)
+                break;
+            status = 0;
+          } /*for*/
+        if (status == 0)
+          {
+            snprintf(path, sizeof path, "%s/" BLOB_STORE_STAMP, store->root);
+            fd = store->backend->open(store->backend, path, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+            if (fd >= 0)
               {
-                status = action(thispath, actionarg);
+                close(fd);
               }
             else
               {
-                errno = 0; /* ignore stat result */
+                status = -1;
               } /*if*/
-          }
-        while (false);
-        free(thispath);
-        return
-            status;
-      } /*try_component*/;
-
-    const char * const home_path = config ? xdg_get_config_home(false) : xdg_get_data_home(false);
-    const char * const search_path = config ? xdg_config_search_path() : xdg_data_search_path();
-    do /*once*/
+          } /*if*/
+      } /*if*/
+    if (status == 0)
       {
-        if (forwards)
+        for (shard = 0; shard < 256; ++shard)
           {
-            status = try_component((const unsigned char *)home_path, strlen(home_path), 0);
+            snprintf(path, sizeof path, "%s/%02x", store->root, shard);
+            status = store->backend->readdir(store->backend, path, scan_entry, 0);
+            if (status != 0 && errno == ENOENT)
+              {
+                status = 0; /* removed while empty, will be recreated when needed */
+              } /*if*/
             if (status != 0)
                 break;
+          } /*for*/
+      } /*if*/
+    return
+        status;
+  } /*blob_store_prepare*/
+
+xdg_blob_store * xdg_context_blob_store_open
+  (
+    const xdg_context * ctx,
+    const char * appname,
+    size_t bloom_bits
+  )
+  /* as for xdg_blob_store_open, but resolving for ctx, and going through its
+    filesystem backend, which must remain valid for as long as the store is open.
+    Fails with EOPNOTSUPP if that is a backend from xdg_memfs_backend_new, since
+    files there have no contents, and with EPERM if ctx is for some other user,
+    since everything the store creates would belong to the calling process. */
+  {
+    char * const itempath = path_join(appname, BLOB_STORE_DIR);
+    char * root = 0;
+    xdg_blob_store * store = 0;
+    do /*once*/
+      {
+        size_t root_len;
+        if (itempath == 0)
+            break;
+        if (context_backend(ctx)->stat == memfs_stat)
+          {
+            errno = EOPNOTSUPP; /* memfs files have no contents to store blobs in */
+            break;
           } /*if*/
-        status = xdg_for_each_path_component
-          (
-            /*path =*/ (const unsigned char *)search_path,
-            /*path_len =*/ strlen(search_path),
-            /*action =*/ try_component,
-            /*actionarg =*/ 0,
-            /*forwards =*/ forwards
-          );
-        if (status != 0)
+        if (context_uid(ctx) != geteuid())
+          {
+            errno = EPERM; /* shards and blobs would not belong to the user */
+            break;
+          } /*if*/
+        root = xdg_context_find_cache_path(ctx, itempath, true);
+        if (root == 0)
             break;
-        if (!forwards)
+        root_len = strlen(root);
+        if (root_len + BLOB_PATH_EXTRA >= PATH_MAX)
           {
-            status = try_component((const unsigned char *)home_path, strlen(home_path), 0);
-            if (status != 0)
+            errno = ENAMETOOLONG;
+            break;
+          } /*if*/
+        store = malloc(sizeof(xdg_blob_store) + root_len + 1);
+        if (store == 0)
+            break;
+        store->backend = context_backend(ctx);
+        memcpy(store->root, root, root_len + 1);
+        store->root_len = root_len;
+        store->bloom = 0;
+        store->bloom_mask = 0;
+        if (bloom_bits != 0)
+          {
+            size_t nr_bits = 64;
+            while (nr_bits < bloom_bits && nr_bits * 2 != 0)
+              {
+                nr_bits *= 2;
+              } /*while*/
+            store->bloom = calloc(nr_bits / 64, sizeof(uint64_t));
+            if (store->bloom == 0)
+              {
+                free(store);
+                store = 0;
                 break;
+              } /*if*/
+            store->bloom_mask = nr_bits - 1;
+          } /*if*/
+        if (blob_store_prepare(store) != 0)
+          {
+            xdg_blob_store_close(store);
+            store = 0;
+            break;
           } /*if*/
       }
     while (false);
-    free((void *)home_path);
-    free((void *)search_path);
+    free(root);
+    free(itempath);
     return
-        status;
-  } /*xdg_for_each_found*/
+        store;
+  } /*xdg_context_blob_store_open*/
 
-static char * xdg_find_first_path
+xdg_blob_store * xdg_blob_store_open
   (
-    const char * itempath, /* assumed relative */
-    bool config /* true for config, false for data */
+    const char * appname,
+    size_t bloom_bits
   )
-  /* common internal routine for both xdg_find_first_config_path and xdg_find_first_data_path. */
+  /* opens the content-addressed store of blobs for appname, kept under a "blobs"
+    subdirectory of its cache directory, creating it if necessary. Blobs are named by
+    the SHA-256 digest of their contents, and sharded by the first byte of that into
+    256 subdirectories, which are created once when the store is first opened. Each
+    open lists the shard directories, and removes any partly-written blobs more than
+    an hour old, which were left behind by writers that crashed before finishing.
+
+    If bloom_bits is nonzero, an in-memory presence filter of (at least) that many
+    bits is kept, filled in at open time by listing the shard directories. After
+    that, lookups for blobs that are definitely absent are answered without going
+    to the filesystem. Note that the filter only knows about blobs put through this
+    handle, or present when it was opened, so don't use it if other processes may
+    add blobs that you need to see. About 10 bits per expected blob keeps false
+    positives down to a few percent.
+
+    Returns NULL and sets errno on error. Dispose of the result with
+    xdg_blob_store_close. */
   {
-    char * result = 0;
-    errno = 0;
-    int save_item
-      (
-        const char * itempath,
-        void * unused
-      )
-      {
-        result = strdup(itempath);
-        return
-            result != 0;
-      } /*save_item*/;
-    (void)xdg_for_each_found
-      (
-        /*itempath =*/ itempath,
-        /*config =*/ config,
-        /*action =*/ save_item,
-        /*actionarg =*/ 0,
-        /*forwards =*/ true
-      );
-    if (result == 0 && errno == 0)
-      {
-        errno = ENOENT;
-      } /*if*/
     return
-        result;
-  } /*xdg_find_first_path*/
+        xdg_context_blob_store_open(0, appname, bloom_bits);
+  } /*xdg_blob_store_open*/
 
-char * xdg_find_first_config_path
+void xdg_blob_store_close
   (
-    const char * itempath
+    xdg_blob_store * store
   )
-  /* searches for itempath in all the config directory locations in order of decreasing
-    priority, returning the expansion where it is first found, or NULL if not found.
-    Caller must dispose of the result pointer. */
+  /* disposes of a store handle. Does nothing if store is NULL. */
   {
-    return
-        xdg_find_first_path(itempath, true);
-  } /*xdg_find_first_config_path*/
+    if (store != 0)
+      {
+        free(store->bloom);
+        free(store);
+      } /*if*/
+  } /*xdg_blob_store_close*/
 
-int xdg_find_all_config_path
+bool xdg_blob_store_contains
   (
-    const char * itempath, /* relative path of item to look for in each directory */
-    xdg_item_path_action action,
-    void * actionarg,
-    bool forwards /* false to do in reverse */
+    const xdg_blob_store * store,
+    const unsigned char digest[XDG_BLOB_DIGEST_SIZE]
   )
-  /* searches for itempath in all the config directory locations, and invokes the
-    specified action for each instance found. Returns nonzero on error, or if action
-    returned nonzero. */
+  /* returns true if the store holds a blob with the specified digest, false if
+    not (or if this couldn't be determined). */
   {
+    char path[PATH_MAX];
+    struct stat statinfo;
+    bool result = false;
+    if (store->bloom == 0 || bloom_probe(store, digest, false))
+      {
+        blob_path(store, digest, path);
+        result = store->backend->stat(store->backend, path, &statinfo) == 0;
+      } /*if*/
     return
-        xdg_for_each_found
-          (
-            /*itempath =*/ itempath,
-            /*config =*/ true,
-            /*action =*/ action,
-            /*actionarg =*/ actionarg,
-            /*forwards =*/ forwards
-          );
-  } /*xdg_find_all_config_path*/
+        result;
+  } /*xdg_blob_store_contains*/
 
-char * xdg_find_first_data_path
+int xdg_blob_store_put
   (
-    const char * itempath
+    const xdg_blob_store * store,
+    const void * data,
+    size_t data_len,
+    unsigned char digest[XDG_BLOB_DIGEST_SIZE] /* returned */
   )
-  /* searches for itempath in all the data directory locations in order of decreasing
-    priority, returning the expansion where it is first found, or NULL if not found.
-    Caller must dispose of the result pointer. */
+  /* adds the specified data to the store, if it's not already there, and returns
+    its digest. The contents are written to a temporary file in the shard directory
+    which is then renamed into place, so a blob is never seen partially written;
+    however, it is not synced to disk, this being a cache. Returns nonzero and sets
+    errno on error. */
   {
+    static unsigned int tempcount = 0;
+    char path[PATH_MAX];
+    char temppath[PATH_MAX];
+    int fd = -1;
+    int status = -1;
+    bool shard_made = false;
+    temppath[0] = '\0';
+    sha256(data, data_len, digest);
+    do /*once*/
+      {
+        const unsigned char * out = data;
+        size_t remaining = data_len;
+        if (xdg_blob_store_contains(store, digest))
+          {
+            status = 0;
+            break;
+          } /*if*/
+        blob_path(store, digest, path);
+        for (;;)
+          {
+            snprintf
+              (
+                temppath,
+                sizeof temppath,
+                "%s/%02x/" BLOB_TEMP_PREFIX "%ld.%u",
+                store->root,
+                digest[0],
+                (long)getpid(),
+                __atomic_fetch_add(&tempcount, 1, __ATOMIC_RELAXED)
+              );
+            fd = store->backend->open
+              (
+                store->backend,
+                temppath,
+                O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                0600
+              );
+            if (fd >= 0)
+                break;
+            if (errno == ENOENT && !shard_made)
+              {
+              /* shard directory removed since the store was set up, e.g. by something
+                tidying away empty directories; recreate it and try again */
+                snprintf(temppath, sizeof temppath, "%s/%02x", store->root, digest[0]);
+                if
+                  (
+                        store->backend->mkdir(store->backend, temppath, 0700) != 0
+                    &&
+                        errno != EEXIST
+                  )
+                  {
+                    temppath[0] = '\0';
+                    break;
+                  } /*if*/
+                shard_made = true;
+              }
+            else if (errno != EEXIST)
+              {
+                break;
+              } /*if*/
+          } /*for*/
+        if (fd < 0)
+          {
+            temppath[0] = '\0'; /* nothing to clean up */
+            break;
+          } /*if*/
+        while (remaining != 0)
+          {
+            const ssize_t written = write(fd, out, remaining);
+            if (written < 0)
+              {
+                if (errno == EINTR)
+                    continue;
+                break;
+              } /*if*/
+            out += written;
+            remaining -= written;
+          } /*while*/
+        if (remaining != 0)
+            break;
+        status = close(fd);
+        fd = -1;
+        if (status != 0)
+            break;
+        status = store->backend->rename(store->backend, temppath, path);
+      }
+    while (false);
+    if (fd >= 0 || (status != 0 && temppath[0] != '\0'))
+      {
+        const int save_errno = errno;
+        if (fd >= 0)
+          {
+            close(fd);
+          } /*if*/
+        store->backend->unlink(store->backend, temppath);
+        errno = save_errno;
+      } /*if*/
+    if (status == 0 && store->bloom != 0)
+      {
+        (void)bloom_probe(store, digest, true);
+      } /*if*/
     return
-        xdg_find_first_path(itempath, false);
-  } /*xdg_find_first_data_path*/
+        status;
+  } /*xdg_blob_store_put*/
 
-int xdg_find_all_data_path
+const void * xdg_blob_store_get
   (
-    const char * itempath, /* relative path of item to look for in each directory */
-    xdg_item_path_action action,
-    void * actionarg,
-    bool forwards /* false to do in reverse */
+    const xdg_blob_store * store,
+    const unsigned char digest[XDG_BLOB_DIGEST_SIZE],
+    size_t * data_len /* returned */
   )
-  /* searches for itempath in all the data directory locations, and invokes the
-    specified action for each instance found. Returns nonzero on error, or if action
-    returned nonzero. */
+  /* returns a read-only mapping of the contents of the blob with the specified
+    digest, and its length in *data_len. Dispose of the mapping with
+    xdg_blob_store_release. Returns NULL and sets errno on error (ENOENT if the
+    blob is not present). */
   {
+    char path[PATH_MAX];
+    const void * result = 0;
+    int fd = -1;
+    do /*once*/
+      {
+        struct stat statinfo;
+        if (store->bloom != 0 && !bloom_probe(store, digest, false))
+          {
+            errno = ENOENT;
+            break;
+          } /*if*/
+        blob_path(store, digest, path);
+        fd = store->backend->open(store->backend, path, O_RDONLY | O_CLOEXEC, 0);
+        if (fd < 0)
+            break;
+        if (fstat(fd, &statinfo) != 0)
+            break;
+        *data_len = statinfo.st_size;
+        if (*data_len == 0)
+          {
+            result = ""; /* can't mmap zero bytes */
+            break;
+          } /*if*/
+        result = mmap(0, *data_len, PROT_READ, MAP_SHARED, fd, 0);
+        if (result == MAP_FAILED)
+          {
+            result = 0;
+            break;
+          } /*if*/
+      }
+    while (false);
+    close_keep_errno(fd);
     return
-        xdg_for_each_found
-          (
-            /*itempath =*/ itempath,
-            /*config =*/ false,
-            /*action =*/ action,
-            /*actionarg =*/ actionarg,
-            /*forwards =*/ forwards
-          );
-  } /*xdg_find_all_data_path*/
+        result;
+  } /*xdg_blob_store_get*/
 
-char * xdg_find_cache_path
+void xdg_blob_store_release
   (
-    const char * itempath,
-    bool create_if
+    const void * data,
+    size_t data_len
   )
-  /* returns an expansion for itempath in the cache directory area. Caller must
-    dispose of the result pointer. */
+  /* disposes of a mapping returned from xdg_blob_store_get. */
   {
-    const char * const cache_home = xdg_get_cache_home(false);
-    char * result = 0;
-    if (cache_home != 0)
+    if (data_len != 0)
       {
-        const size_t result_maxlen = strlen(cache_home) + 1 + strlen(itempath) + 1;
-        result = malloc(result_maxlen);
-        if (result != 0)
-          {
-            strncpy(result, cache_home, result_maxlen);
-            if (result[0] != '\0' && result[strlen(result) - 1] != '/')
-              {
-                strconcat(result, result_maxlen, "/");
-              } /*if*/
-            strconcat(result, result_maxlen, itempath);
-            if (create_if && xdg_makedirsif(result) != 0)
-              {
-                free(result);
-                result = 0;
-              } /*if*/
-          } /*if*/
-        free((void *)cache_home);
+        munmap((void *)data, data_len);
       } /*if*/
+  } /*xdg_blob_store_release*/
+
+int xdg_blob_store_remove
+  (
+    const xdg_blob_store * store,
+    const unsigned char digest[XDG_BLOB_DIGEST_SIZE]
+  )
+  /* removes the blob with the specified digest from the store. Existing mappings
+    of it remain valid. Returns nonzero and sets errno on error (ENOENT if the blob
+    is not present). */
+  {
+    char path[PATH_MAX];
+    blob_path(store, digest, path);
     return
-        result;
-  } /*xdg_find_cache_path*/
+        store->backend->unlink(store->backend, path);
+  } /*xdg_blob_store_remove*/
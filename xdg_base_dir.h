@@ -7,10 +7,58 @@
         xdg_find_all_config_path, xdg_find_all_data_path
     * find highest-priority config/data file:
         xdg_find_first_config_path, xdg_find_first_data_path
+    * find best of several alternative config/data files (e.g. locale variants):
+        xdg_find_first_variant_config_path, xdg_find_first_variant_data_path
     * find location to create user-specific config/data/cache file:
         xdg_get_config_home, xdg_get_data_home, xdg_get_cache_home, xdg_find_cache_path
+    * runtime files (sockets, locks, shared memory):
+        xdg_get_runtime_dir, xdg_runtime_socket, xdg_runtime_connect, xdg_runtime_lock,
+        xdg_runtime_shm
     * utility:
-        xdg_makedirsif
+        xdg_makedirsif, xdg_flush_listings
+    * content-addressed blob store in the cache area:
+        xdg_blob_store_open, xdg_blob_store_close, xdg_blob_store_put,
+        xdg_blob_store_get, xdg_blob_store_release, xdg_blob_store_contains,
+        xdg_blob_store_remove
+    * resolving on behalf of other users:
+        xdg_context_new, xdg_context_new_for_user, xdg_context_dispose, and
+        xdg_context_xxx versions of the above
+    * find and open highest-priority config/data file with readahead started:
+        xdg_open_first_config_path, xdg_open_first_data_path,
+        xdg_prefetch_config_paths, xdg_prefetch_data_paths
+    * resolving against something other than the live filesystem:
+        xdg_posix_backend, xdg_sysroot_backend_new, xdg_memfs_backend_new,
+        xdg_memfs_add, xdg_memfs_load_manifest, xdg_fs_backend_dispose,
+        xdg_context_set_backend
+    * handing resolution results down to child processes:
+        xdg_export
+
+    The xdg_context_xxx routines take a context as their first argument, which may be
+    NULL to resolve using the calling process's own environment, exactly as the
+    corresponding routines without a context do. Contexts for the same system search
+    paths and filesystem backend share a single copy of the state for those, so each
+    one only adds storage for its home directory and explicit per-user settings. Once
+    set up, a context is not modified, and may be used from multiple threads at once.
+    Directories are only ever created by the calling process, so asking for them to
+    be created (makedirs or create_if) for a context for some other user fails with
+    EPERM unless they already exist; create them for that user some other way.
+
+    Lookups remember which entries each system search directory contains, so they can
+    skip directories that cannot hold the item without any filesystem access. A
+    remembered listing is rechecked against the directory's modification time at most
+    once a second, so an item newly added directly under a system directory may take
+    that long to be found; call xdg_flush_listings if it needs to be seen at once.
+
+    A process that starts many helpers can save them repeating its own lookups by
+    passing them a snapshot from xdg_export. A helper picks this up on first use of
+    the routines without a context, and only if its own environment resolves to the
+    same directories and none of those has been modified since the snapshot was made;
+    otherwise it just resolves everything as usual. Recorded items are checked to
+    still exist before being returned, and items not found by the exporter are always
+    searched for again. The snapshot is no longer consulted once a recorded item turns
+    out to be gone, or a few seconds after export, so it can only ever answer with a
+    lower-priority instance of an item than a fresh search would, and only when a
+    higher-priority one was created within that window.
 
     Strategies for dealing with multiple configuration/data files are up to you.
     Common strategies are:
@@ -24,6 +72,81 @@
 
 #include <stdbool.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+
+typedef struct xdg_context xdg_context; /* opaque */
+typedef struct xdg_blob_store xdg_blob_store; /* opaque */
+
+#define XDG_BLOB_DIGEST_SIZE 32 /* bytes in a blob-store digest (SHA-256) */
+#define XDG_CONTEXT_FD_ENV "XDG_BASE_DIR_CONTEXT_FD"
+  /* environment variable for passing a snapshot from xdg_export to child processes */
+
+typedef enum /* how to choose among candidates in different directories */
+  {
+    XDG_VARIANT_DIRECTORY_MAJOR, /* directory priority first, then candidate order */
+    XDG_VARIANT_CANDIDATE_MAJOR, /* candidate order first, then directory priority */
+  } xdg_variant_policy;
+
+typedef int (*xdg_dir_entry_action)
+  (
+    const char * name, /* entry name, storage belongs to me */
+    void * arg /* meaning is up to you */
+  );
+  /* return nonzero to abort the scan */
+
+typedef struct xdg_fs_backend xdg_fs_backend;
+struct xdg_fs_backend
+  /* the filesystem operations used for config, data and cache lookups. Each one
+    takes the backend itself as its first argument, so an implementation can embed
+    this as the first member of a larger structure holding its own state, and
+    otherwise behaves like the corresponding POSIX call, returning -1 and setting
+    errno on error. */
+  {
+    int (*stat)
+      (
+        xdg_fs_backend * self,
+        const char * path,
+        struct stat * statinfo
+      );
+    int (*open)
+      (
+        xdg_fs_backend * self,
+        const char * path,
+        int flags,
+        mode_t mode
+      );
+    int (*mkdir)
+      (
+        xdg_fs_backend * self,
+        const char * path,
+        mode_t mode
+      );
+    int (*readdir)
+      (
+        xdg_fs_backend * self,
+        const char * path,
+        xdg_dir_entry_action action,
+        void * actionarg
+      );
+      /* invokes action for each entry in the directory other than "." and "..".
+        Returns nonzero on error, or if action returned nonzero. */
+    int (*rename)
+      (
+        xdg_fs_backend * self,
+        const char * oldpath,
+        const char * newpath
+      );
+    int (*unlink)
+      (
+        xdg_fs_backend * self,
+        const char * path
+      );
+    void (*dispose)
+      (
+        xdg_fs_backend * self
+      );
+      /* NULL if there is nothing to dispose of */
+  };
 
 int xdg_makedirsif
   (
@@ -32,6 +155,111 @@ int xdg_makedirsif
   /* creates all the directories in path, if they don't already exist. Returns
     nonzero and sets errno on error. */
 
+xdg_context * xdg_context_new
+  (
+    const char * home,
+    uid_t uid,
+    const char * const * vars
+  );
+  /* creates a resolution context for the user with the specified home directory and
+    user ID. vars is NULL or a NULL-terminated array of "NAME=value" strings in the
+    manner of environ: any XDG_CONFIG_HOME, XDG_DATA_HOME, XDG_CACHE_HOME or
+    XDG_RUNTIME_DIR entries in it override the defaults derived from home and uid, and
+    any XDG_CONFIG_DIRS or XDG_DATA_DIRS entries override the system search paths,
+    which otherwise come from the process environment. Other entries are ignored.
+    Returns NULL and sets errno on error. Dispose of the result with
+    xdg_context_dispose. */
+
+xdg_context * xdg_context_new_for_user
+  (
+    const char * username
+  );
+  /* creates a resolution context for the named user, taking the home directory and
+    user ID from the password database, with no explicit per-user settings. Returns
+    NULL and sets errno on error (ENOENT if there is no such user). Dispose of the
+    result with xdg_context_dispose. */
+
+void xdg_context_dispose
+  (
+    xdg_context * ctx
+  );
+  /* disposes of a context created by xdg_context_new or xdg_context_new_for_user.
+    Does nothing if ctx is NULL. */
+
+int xdg_context_set_backend
+  (
+    xdg_context * ctx,
+    xdg_fs_backend * backend
+  );
+  /* makes all config, data and cache lookups for ctx go through the specified
+    filesystem backend, which must remain valid for as long as ctx uses it. This
+    must be done before ctx is shared between threads. Runtime-directory routines
+    always use the live filesystem. Returns nonzero and sets errno on error. */
+
+xdg_fs_backend * xdg_posix_backend(void);
+  /* returns the backend that operates directly on the live filesystem. This is
+    what is used unless another one is specified; it need not be disposed. */
+
+xdg_fs_backend * xdg_sysroot_backend_new
+  (
+    const char * sysroot
+  );
+  /* returns a backend that operates on the live filesystem, but with all paths
+    resolved within the directory sysroot, e.g. an unpacked container image, as
+    though the process had been chrooted there: ".." components and symlinks,
+    including absolute ones, cannot lead outside it. This relies on openat2(2),
+    available from Linux 5.6; fails with ENOSYS if it's not. Returns NULL and sets
+    errno on error. Dispose of the result with xdg_fs_backend_dispose. */
+
+xdg_fs_backend * xdg_memfs_backend_new(void);
+  /* returns a backend that operates on a tree held entirely in memory, initially
+    containing only an empty root directory. Populate it with xdg_memfs_add or
+    xdg_memfs_load_manifest, or via its mkdir and open (with O_CREAT) operations.
+    Files have a size but no contents: opening one returns an anonymous file of that
+    size reading as all zeroes. All operations are safe to use from multiple
+    threads. Returns NULL and sets errno on error. Dispose of the result with
+    xdg_fs_backend_dispose. */
+
+int xdg_memfs_add
+  (
+    xdg_fs_backend * memfs,
+    const char * path,
+    mode_t type, /* S_IFDIR or S_IFREG */
+    off_t size /* ignored for directories */
+  );
+  /* adds an entry to a backend created by xdg_memfs_backend_new, creating any
+    missing parent directories. If the entry already exists with the same type,
+    its size is updated. Returns nonzero and sets errno on error. */
+
+int xdg_memfs_load_manifest
+  (
+    xdg_fs_backend * memfs,
+    const char * manifest_path
+  );
+  /* adds the entries listed in the specified manifest file to a backend created by
+    xdg_memfs_backend_new. Each line of the manifest has the form
+
+        type size path
+
+    where type is "d" for a directory or a single letter for any other kind of
+    entry (which is added as a regular file), size is a decimal byte count and path
+    is relative to the root of the tree. Blank lines and lines beginning with "#"
+    are ignored. This is the format produced by
+
+        find . -printf '%y %s %P\n'
+
+    run at the top of an unpacked image. Returns nonzero and sets errno on error
+    (EINVAL for a malformed line), in which case entries from preceding lines will
+    still have been added. */
+
+void xdg_fs_backend_dispose
+  (
+    xdg_fs_backend * backend
+  );
+  /* disposes of a backend created by xdg_sysroot_backend_new or
+    xdg_memfs_backend_new, or any other one that has a dispose operation. Does
+    nothing if backend is NULL. It must no longer be in use by any context. */
+
 char * xdg_make_home_relative
   (
     const char * path
@@ -40,6 +268,15 @@ char * xdg_make_home_relative
     NULL on error (out of memory, $HOME not defined or not absolute). Caller must dispose
     of the result pointer. */
 
+char * xdg_context_make_home_relative
+  (
+    const xdg_context * ctx,
+    const char * path
+  );
+  /* prepends the home directory for ctx onto path (assumed not to begin with a
+    slash), or NULL on error (out of memory, home not defined or not absolute).
+    Caller must dispose of the result pointer. */
+
 char * xdg_get_config_home
   (
     bool makedirs
@@ -47,6 +284,14 @@ char * xdg_get_config_home
   /* returns the directory for holding user-specific config files, or NULL on
     error. Caller must dispose of the result pointer. */
 
+char * xdg_context_get_config_home
+  (
+    const xdg_context * ctx,
+    bool makedirs
+  );
+  /* returns the directory for holding user-specific config files for ctx, or NULL on
+    error. Caller must dispose of the result pointer. */
+
 char * xdg_get_data_home
   (
     bool makedirs
@@ -61,6 +306,14 @@ char * xdg_get_data_home
   /* returns the directory for holding user-specific data files, or NULL on
     error. Caller must dispose of the result pointer. */
 
+char * xdg_context_get_data_home
+  (
+    const xdg_context * ctx,
+    bool makedirs
+  );
+  /* returns the directory for holding user-specific data files for ctx, or NULL on
+    error. Caller must dispose of the result pointer. */
+
 char * xdg_get_cache_home
   (
     bool makedirs
@@ -68,14 +321,102 @@ char * xdg_get_cache_home
   /* returns the directory for holding user-specific cache files, or NULL on
     error. Caller must dispose of the result pointer. */
 
+char * xdg_context_get_cache_home
+  (
+    const xdg_context * ctx,
+    bool makedirs
+  );
+  /* returns the directory for holding user-specific cache files for ctx, or NULL on
+    error. Caller must dispose of the result pointer. */
+
+char * xdg_get_runtime_dir
+  (
+    bool makedirs
+  );
+  /* returns the directory for holding user-specific runtime files (sockets, locks,
+    shared memory and the like), or NULL on error. This is $XDG_RUNTIME_DIR if that
+    passes the ownership and permission checks required by the spec, otherwise
+    /run/user/<uid> if that passes the same checks. Failing both, the fallback is a
+    private directory xdg-runtime-<uid> under $TMPDIR (or /tmp), created if makedirs,
+    and used if it passes the checks; note this may not be on tmpfs, and will not be
+    cleaned up at logout. Caller must dispose of the result pointer. */
+
+char * xdg_context_get_runtime_dir
+  (
+    const xdg_context * ctx,
+    bool makedirs
+  );
+  /* returns the directory for holding user-specific runtime files for ctx, as for
+    xdg_get_runtime_dir but using the explicit XDG_RUNTIME_DIR setting and user ID
+    of ctx. If ctx is for some other user, the fallback directory is never created,
+    and makedirs fails with EPERM if it does not already exist. Caller must dispose
+    of the result pointer. */
+
+int xdg_runtime_socket
+  (
+    const char * itempath,
+    int type
+  );
+  /* creates a UNIX-domain socket of the specified type (SOCK_STREAM, SOCK_DGRAM or
+    SOCK_SEQPACKET) bound to itempath within the runtime directory, and puts it into
+    the listening state if the type is connection-oriented. A socket file left over
+    from a process that is no longer listening is replaced; one that is still live, or
+    anything at itempath that is not a socket, is not, and the call fails with errno
+    set to EADDRINUSE. Returns the socket fd, or -1 and sets errno on error. */
+
+int xdg_runtime_connect
+  (
+    const char * itempath,
+    int type
+  );
+  /* returns a UNIX-domain socket of the specified type connected to the socket at
+    itempath within the runtime directory, or -1 and sets errno on error. */
+
+int xdg_runtime_lock
+  (
+    const char * itempath,
+    bool wait
+  );
+  /* opens (creating if necessary) the file itempath within the runtime directory and
+    takes an exclusive flock(2) on it. If wait, blocks until the lock is free, otherwise
+    fails with errno set to EWOULDBLOCK if another process holds it. On success the
+    PID of the calling process is written into the file, so it can double as a
+    pidfile; the lock is held for as long as the returned fd (or any dup of it) stays
+    open. Returns -1 and sets errno on error. */
+
+int xdg_runtime_shm
+  (
+    const char * itempath,
+    size_t size
+  );
+  /* returns an fd for a memory-backed file of at least size bytes, suitable for
+    mmap(2). If itempath is NULL the file is anonymous (from memfd_create(2), with
+    sealing allowed); otherwise it is the named file within the runtime directory,
+    created with mode 0600 if it doesn't exist, and extended to size if shorter.
+    Returns -1 and sets errno on error. */
+
 char * xdg_config_search_path(void);
   /* returns a string containing the colon-separated list of config directories to search
     (apart from the user area). Caller must dispose of the result pointer. */
 
+char * xdg_context_config_search_path
+  (
+    const xdg_context * ctx
+  );
+  /* returns a string containing the colon-separated list of config directories to
+    search for ctx (apart from the user area). Caller must dispose of the result pointer. */
+
 char * xdg_data_search_path(void);
   /* returns a string containing the colon-separated list of data directories to search
     (apart from the user area). Caller must dispose of the result pointer. */
 
+char * xdg_context_data_search_path
+  (
+    const xdg_context * ctx
+  );
+  /* returns a string containing the colon-separated list of data directories to
+    search for ctx (apart from the user area). Caller must dispose of the result pointer. */
+
 typedef int (*xdg_path_component_action)
   (
     const unsigned char * path, /* storage belongs to me, make a copy if you want to keep it */
@@ -111,6 +452,13 @@ char * xdg_find_first_config_path
     priority, returning the expansion where it is first found, or NULL if not found.
     Caller must dispose of the result pointer. */
 
+char * xdg_context_find_first_config_path
+  (
+    const xdg_context * ctx,
+    const char * itempath
+  );
+  /* as for xdg_find_first_config_path, but resolving for ctx. */
+
 int xdg_find_all_config_path
   (
     const char * itempath, /* relative path of item to look for in each directory */
@@ -122,6 +470,16 @@ int xdg_find_all_config_path
     specified action for each instance found. Returns nonzero on error, or if action
     returned nonzero. */
 
+int xdg_context_find_all_config_path
+  (
+    const xdg_context * ctx,
+    const char * itempath,
+    xdg_item_path_action action,
+    void * actionarg,
+    bool forwards
+  );
+  /* as for xdg_find_all_config_path, but resolving for ctx. */
+
 char * xdg_find_first_data_path
   (
     const char * itempath
@@ -130,6 +488,13 @@ char * xdg_find_first_data_path
     priority, returning the expansion where it is first found, or NULL if not found.
     Caller must dispose of the result pointer. */
 
+char * xdg_context_find_first_data_path
+  (
+    const xdg_context * ctx,
+    const char * itempath
+  );
+  /* as for xdg_find_first_data_path, but resolving for ctx. */
+
 int xdg_find_all_data_path
   (
     const char * itempath, /* relative path of item to look for in each directory */
@@ -141,6 +506,58 @@ int xdg_find_all_data_path
     specified action for each instance found. Returns nonzero on error, or if action
     returned nonzero. */
 
+int xdg_context_find_all_data_path
+  (
+    const xdg_context * ctx,
+    const char * itempath,
+    xdg_item_path_action action,
+    void * actionarg,
+    bool forwards
+  );
+  /* as for xdg_find_all_data_path, but resolving for ctx. */
+
+char * xdg_find_first_variant_config_path
+  (
+    const char * const * candidates,
+    xdg_variant_policy policy,
+    int * which
+  );
+  /* searches all the config directory locations for the best match among the
+    NULL-terminated list of candidate item paths, given in decreasing order of
+    preference, in a single pass. With XDG_VARIANT_DIRECTORY_MAJOR, the match is
+    the most preferred candidate in the highest-priority directory holding any of
+    them; with XDG_VARIANT_CANDIDATE_MAJOR, it is the highest-priority instance of the
+    most preferred candidate found anywhere. Returns the expansion of the match,
+    setting *which (if which is not NULL) to its index in candidates, or NULL if
+    none is found. Caller must dispose of the result pointer. */
+
+char * xdg_context_find_first_variant_config_path
+  (
+    const xdg_context * ctx,
+    const char * const * candidates,
+    xdg_variant_policy policy,
+    int * which
+  );
+  /* as for xdg_find_first_variant_config_path, but resolving for ctx. */
+
+char * xdg_find_first_variant_data_path
+  (
+    const char * const * candidates,
+    xdg_variant_policy policy,
+    int * which
+  );
+  /* as for xdg_find_first_variant_config_path, but searching the data directory
+    locations. */
+
+char * xdg_context_find_first_variant_data_path
+  (
+    const xdg_context * ctx,
+    const char * const * candidates,
+    xdg_variant_policy policy,
+    int * which
+  );
+  /* as for xdg_find_first_variant_data_path, but resolving for ctx. */
+
 char * xdg_find_cache_path
   (
     const char * itempath,
@@ -148,3 +565,227 @@ char * xdg_find_cache_path
   );
   /* returns an expansion for itempath in the cache directory area. Caller must
     dispose of the result pointer. */
+
+char * xdg_context_find_cache_path
+  (
+    const xdg_context * ctx,
+    const char * itempath,
+    bool create_if
+  );
+  /* as for xdg_find_cache_path, but resolving for ctx. */
+
+void xdg_flush_listings(void);
+  /* forgets everything remembered about the contents of system search directories,
+    for all contexts, so that subsequent lookups see any changes immediately. */
+
+int xdg_export
+  (
+    const char * const * config_items,
+    const char * const * data_items
+  );
+  /* captures everything known about resolving config and data paths for the calling
+    process into a sealed anonymous file, including where the items in config_items
+    and data_items (each NULL-terminated, or NULL if none) were found, and returns its
+    file descriptor, which is not close-on-exec. Pass its number to child processes
+    in the environment variable named by XDG_CONTEXT_FD_ENV; they make use of it only
+    if they run under the same effective user ID that created it, and only for the
+    first few seconds after export. Returns -1 and sets errno on error. */
+
+int xdg_context_export
+  (
+    const xdg_context * ctx,
+    const char * const * config_items,
+    const char * const * data_items
+  );
+  /* as for xdg_export, but capturing the resolution for ctx. This is only possible
+    for contexts using the live filesystem, and fails with EPERM if ctx is for some
+    other user, since the snapshot would belong to the calling process. */
+
+int xdg_open_first_config_path
+  (
+    const char * itempath,
+    int flags,
+    char ** path
+  );
+  /* searches for itempath in all the config directory locations in order of
+    decreasing priority, as for xdg_find_first_config_path, but opens the item
+    found with the specified open(2) flags (plus O_CLOEXEC) and returns the fd, with
+    readahead of its contents already started. Each candidate is probed by opening it
+    directly, rather than doing a stat followed by an open; one that exists but
+    cannot be opened is skipped. If path is not NULL, *path is set to the expansion
+    that was opened, or NULL if none; caller must dispose of it. Returns -1 and sets
+    errno on error (ENOENT if not found). */
+
+int xdg_context_open_first_config_path
+  (
+    const xdg_context * ctx,
+    const char * itempath,
+    int flags,
+    char ** path
+  );
+  /* as for xdg_open_first_config_path, but resolving for ctx. */
+
+int xdg_open_first_data_path
+  (
+    const char * itempath,
+    int flags,
+    char ** path
+  );
+  /* searches for itempath in all the data directory locations in order of
+    decreasing priority, as for xdg_find_first_data_path, but opens the item
+    found with the specified open(2) flags (plus O_CLOEXEC) and returns the fd, with
+    readahead of its contents already started. Each candidate is probed by opening it
+    directly, rather than doing a stat followed by an open; one that exists but
+    cannot be opened is skipped. If path is not NULL, *path is set to the expansion
+    that was opened, or NULL if none; caller must dispose of it. Returns -1 and sets
+    errno on error (ENOENT if not found). */
+
+int xdg_context_open_first_data_path
+  (
+    const xdg_context * ctx,
+    const char * itempath,
+    int flags,
+    char ** path
+  );
+  /* as for xdg_open_first_data_path, but resolving for ctx. */
+
+int xdg_prefetch_config_paths
+  (
+    const char * const * itempaths,
+    size_t nr_items,
+    int flags,
+    int * fds,
+    char ** paths
+  );
+  /* does xdg_open_first_config_path for each of the nr_items elements of itempaths,
+    spreading the work over several threads so that the directory lookups and
+    readahead for different items all proceed concurrently. fds[i] is set to the fd
+    for itempaths[i], or -1 if it was not found; if paths is not NULL, paths[i] is set
+    to the corresponding expansion, or NULL, which caller must dispose of. Returns
+    the number of items that were opened. */
+
+int xdg_context_prefetch_config_paths
+  (
+    const xdg_context * ctx,
+    const char * const * itempaths,
+    size_t nr_items,
+    int flags,
+    int * fds,
+    char ** paths
+  );
+  /* as for xdg_prefetch_config_paths, but resolving for ctx. */
+
+int xdg_prefetch_data_paths
+  (
+    const char * const * itempaths,
+    size_t nr_items,
+    int flags,
+    int * fds,
+    char ** paths
+  );
+  /* does xdg_open_first_data_path for each of the nr_items elements of itempaths,
+    spreading the work over several threads so that the directory lookups and
+    readahead for different items all proceed concurrently. fds[i] is set to the fd
+    for itempaths[i], or -1 if it was not found; if paths is not NULL, paths[i] is set
+    to the corresponding expansion, or NULL, which caller must dispose of. Returns
+    the number of items that were opened. */
+
+int xdg_context_prefetch_data_paths
+  (
+    const xdg_context * ctx,
+    const char * const * itempaths,
+    size_t nr_items,
+    int flags,
+    int * fds,
+    char ** paths
+  );
+  /* as for xdg_prefetch_data_paths, but resolving for ctx. */
+
+xdg_blob_store * xdg_blob_store_open
+  (
+    const char * appname,
+    size_t bloom_bits
+  );
+  /* opens the content-addressed store of blobs for appname, kept under a "blobs"
+    subdirectory of its cache directory, creating it if necessary. Blobs are named by
+    the SHA-256 digest of their contents, and sharded by the first byte of that into
+    256 subdirectories, which are created once when the store is first opened. Each
+    open lists the shard directories, and removes any partly-written blobs more than
+    an hour old, which were left behind by writers that crashed before finishing.
+
+    If bloom_bits is nonzero, an in-memory presence filter of (at least) that many
+    bits is kept, filled in at open time by listing the shard directories. After
+    that, lookups for blobs that are definitely absent are answered without going
+    to the filesystem. Note that the filter only knows about blobs put through this
+    handle, or present when it was opened, so don't use it if other processes may
+    add blobs that you need to see. About 10 bits per expected blob keeps false
+    positives down to a few percent.
+
+    Returns NULL and sets errno on error. Dispose of the result with
+    xdg_blob_store_close. */
+
+xdg_blob_store * xdg_context_blob_store_open
+  (
+    const xdg_context * ctx,
+    const char * appname,
+    size_t bloom_bits
+  );
+  /* as for xdg_blob_store_open, but resolving for ctx, and going through its
+    filesystem backend, which must remain valid for as long as the store is open.
+    Fails with EOPNOTSUPP if that is a backend from xdg_memfs_backend_new, since
+    files there have no contents, and with EPERM if ctx is for some other user,
+    since everything the store creates would belong to the calling process. */
+
+void xdg_blob_store_close
+  (
+    xdg_blob_store * store
+  );
+  /* disposes of a store handle. Does nothing if store is NULL. */
+
+bool xdg_blob_store_contains
+  (
+    const xdg_blob_store * store,
+    const unsigned char digest[XDG_BLOB_DIGEST_SIZE]
+  );
+  /* returns true if the store holds a blob with the specified digest, false if
+    not (or if this couldn't be determined). */
+
+int xdg_blob_store_put
+  (
+    const xdg_blob_store * store,
+    const void * data,
+    size_t data_len,
+    unsigned char digest[XDG_BLOB_DIGEST_SIZE] /* returned */
+  );
+  /* adds the specified data to the store, if it's not already there, and returns
+    its digest. The contents are written to a temporary file in the shard directory
+    which is then renamed into place, so a blob is never seen partially written;
+    however, it is not synced to disk, this being a cache. Returns nonzero and sets
+    errno on error. */
+
+const void * xdg_blob_store_get
+  (
+    const xdg_blob_store * store,
+    const unsigned char digest[XDG_BLOB_DIGEST_SIZE],
+    size_t * data_len /* returned */
+  );
+  /* returns a read-only mapping of the contents of the blob with the specified
+    digest, and its length in *data_len. Dispose of the mapping with
+    xdg_blob_store_release. Returns NULL and sets errno on error (ENOENT if the
+    blob is not present). */
+
+void xdg_blob_store_release
+  (
+    const void * data,
+    size_t data_len
+  );
+  /* disposes of a mapping returned from xdg_blob_store_get. */
+
+int xdg_blob_store_remove
+  (
+    const xdg_blob_store * store,
+    const unsigned char digest[XDG_BLOB_DIGEST_SIZE]
+  );
+  /* removes the blob with the specified digest from the store. Existing mappings
+    of it remain valid. Returns nonzero and sets errno on error (ENOENT if the blob
+    is not present). */
@@ -10,6 +10,8 @@
 #     find_first_config_path, find_first_data_path
 # * find location to create user-specific config/data/cache file:
 #     get_config_home, get_data_home, get_cache_home, find_cache_path
+# * runtime files (sockets, locks and the like):
+#     get_runtime_dir
 # * utility:
 #     makedirsif
 #
@@ -24,6 +26,7 @@
 #-
 
 import os
+import stat
 import errno
 
 def makedirsif(path) :
@@ -73,6 +76,59 @@ def get_cache_home(makedirs = False) :
     return result
 #end get_cache_home
 
+def _check_runtime_dir(path) :
+    # checks that path is an absolute path to an actual directory (not a symlink)
+    # owned by the current user and accessible only to it, as the spec requires
+    # for $XDG_RUNTIME_DIR.
+    if not path.startswith("/") :
+        return False
+    #end if
+    try :
+        info = os.lstat(path)
+    except OSError :
+        return False
+    #end try
+    return \
+        (
+            stat.S_ISDIR(info.st_mode)
+        and
+            info.st_uid == os.geteuid()
+        and
+            stat.S_IMODE(info.st_mode) == 0o700
+        )
+#end _check_runtime_dir
+
+def get_runtime_dir(makedirs = False) :
+    """returns the directory for holding user-specific runtime files (sockets, locks,
+    shared memory and the like). This is $XDG_RUNTIME_DIR if that passes the ownership
+    and permission checks required by the spec, otherwise /run/user/<uid> if that
+    passes the same checks. Failing both, the fallback is a private directory
+    xdg-runtime-<uid> under $TMPDIR (or /tmp), created if makedirs. Raises OSError
+    if no suitable directory is available."""
+    result = os.environ.get("XDG_RUNTIME_DIR")
+    if result == None or not _check_runtime_dir(result) :
+        result = "/run/user/%d" % os.geteuid()
+        if not _check_runtime_dir(result) :
+            tmpdir = os.environ.get("TMPDIR", "/tmp")
+            if not tmpdir.startswith("/") :
+                tmpdir = "/tmp"
+            #end if
+            result = os.path.join(tmpdir, "xdg-runtime-%d" % os.geteuid())
+            if makedirs :
+                try :
+                    os.mkdir(result, 0o700)
+                except FileExistsError :
+                    pass
+                #end try
+            #end if
+            if not _check_runtime_dir(result) :
+                raise OSError(errno.EACCES, "no usable runtime directory", result)
+            #end if
+        #end if
+    #end if
+    return result
+#end get_runtime_dir
+
 def config_search_path() :
     """returns the list of config directories to search (apart from the user area)."""
     return tuple(os.environ.get("XDG_CONFIG_DIRS", "/etc").split(":"))